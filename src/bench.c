@@ -0,0 +1,591 @@
+/* bench.c - DSP benchmarks, run with `make bench`
+ *
+ * Output is one line per benchmark, with whitespace-separated columns:
+ *   name, ns per sample, samples per second, share of the realtime budget (%)
+ *   and CPU cycles per sample (0 if perf counters aren't available).
+ * Lines starting with '#' are comments. */
+
+#define _GNU_SOURCE
+#include "common.h"
+
+#include <assert.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "controller.h"
+#include "limiter.h"
+#include "mpx.h"
+#include "outputter.h"
+#include "pagepool.h"
+#include "pipeline.h"
+#include "preemp.h"
+#include "resamp.h"
+#include "ring.h"
+
+#define JRATE 48000
+#define RATE 152000
+#define PERIOD 256
+#define PERIODS 2000
+#define OPERIOD 512
+
+
+// MEASURING
+// ---------
+
+static int cycles_fd = -1;
+
+// Open the CPU cycle counter for this thread, if the kernel lets us
+static void open_cycle_counter() {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = PERF_COUNT_HW_CPU_CYCLES;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  cycles_fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t read_cycles() {
+  uint64_t cycles = 0;
+  if (cycles_fd < 0 || read(cycles_fd, &cycles, sizeof(cycles)) != sizeof(cycles))
+    return 0;
+  return cycles;
+}
+
+static double read_time() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+typedef struct {
+  double ns;
+  uint64_t cycles;
+} measure_t;
+
+static void measure_start(measure_t *m) {
+  m->cycles = read_cycles();
+  m->ns = read_time();
+}
+
+static void measure_stop(measure_t *m) {
+  m->cycles = read_cycles() - m->cycles;
+  m->ns = read_time() - m->ns;
+}
+
+// Print a result line; `rate` is the realtime rate (in samples per second)
+// the stage has to keep up with
+static void report(const char *name, const measure_t *m, size_t samples, double rate) {
+  double ns = m->ns / samples;
+  printf("%-32s %10.2f %14.0f %9.3f %10.1f\n", name, ns, 1e9 / ns, ns * rate / 1e7, m->cycles / (double)samples);
+}
+
+
+// INPUT
+// -----
+
+static jackpifm_sample_t *input[2];
+static uint8_t rds_blob[104];
+
+// Music-like test signal, with some peaks exceeding [-1, 1]
+static void generate_input(size_t size) {
+  for (size_t c = 0; c < 2; c++) {
+    input[c] = jackpifm_malloc(size * sizeof(jackpifm_sample_t));
+    for (size_t i = 0; i < size; i++)
+      input[c][i] = 0.6 * sin(i * (0.031 + c * 0.007)) + 0.5 * sin(i * 0.2713) * sin(i * 0.0011);
+  }
+  for (size_t i = 0; i < sizeof(rds_blob); i++)
+    rds_blob[i] = i * 37 + 11;
+}
+
+
+// PIPELINE: fused vs separate passes
+// ----------------------------------
+
+static jackpifm_ring_t *ring;
+
+// Run the pipeline straight into the ringbuffer, as process_callback() does
+static size_t fused_period(jackpifm_pipeline_t *pipeline, jackpifm_sample_t **in, float *reduction) {
+  size_t count = jackpifm_pipeline_count(pipeline, PERIOD);
+  jackpifm_pipeline_process(pipeline, in, PERIOD, jackpifm_ring_write_begin(ring, count), reduction);
+  jackpifm_ring_write_commit(ring, count);
+  return count;
+}
+
+// The chain as it was run before the pipeline existed: one full pass per stage
+static size_t unfused_period(jackpifm_limiter_t **limiter, jackpifm_preemp_t *preemp, jackpifm_resamp_t **resampler,
+                             jackpifm_mpx_t *mpx, jackpifm_sample_t **in, jackpifm_sample_t **rbuffer) {
+  float reduction = 0;
+  jackpifm_limiter_process(limiter[0], in, PERIOD, &reduction);
+  jackpifm_preemp_process(preemp, in, PERIOD);
+  jackpifm_limiter_process(limiter[1], in, PERIOD, &reduction);
+
+  size_t count = jackpifm_resamp_process(resampler[0], rbuffer[0], in[0], PERIOD);
+  jackpifm_resamp_process(resampler[1], rbuffer[1], in[1], PERIOD);
+  jackpifm_mpx_process(mpx, rbuffer[0], rbuffer[0], rbuffer[1], count);
+  jackpifm_ring_write(ring, rbuffer[0], count);
+  return count;
+}
+
+static void bench_pipeline() {
+  jackpifm_pipeline_config_t config = { 2, JRATE, RATE, true, 75e-6, false, 5, 10, rds_blob, sizeof(rds_blob), 0.1, 0.05, 1, 0.001, 0.05, false };
+  jackpifm_pipeline_t *pipeline = jackpifm_pipeline_new(&config);
+
+  double ratio = JRATE / (double)RATE;
+  jackpifm_limiter_t *limiter[2];
+  jackpifm_preemp_t *preemp = jackpifm_preemp_new(2, JRATE, 75e-6);
+  jackpifm_resamp_t *resampler[2];
+  jackpifm_sample_t *rbuffer[2], *in[2], *ref[2];
+  for (size_t c = 0; c < 2; c++) {
+    limiter[c] = jackpifm_limiter_new(2, JRATE, 1, 0.001, 0.05);
+    resampler[c] = jackpifm_resamp_new(ratio, 5, 10);
+    rbuffer[c] = jackpifm_malloc((PERIOD / ratio + 2) * sizeof(jackpifm_sample_t));
+    in[c] = jackpifm_malloc(PERIOD * sizeof(jackpifm_sample_t));
+  }
+  jackpifm_mpx_config_t mpx_config = { true, 0.45, 0.1, 0.05, rds_blob, sizeof(rds_blob) };
+  jackpifm_mpx_t *mpx = jackpifm_mpx_new(&mpx_config);
+
+  size_t out_size = PERIOD / ratio + 2;
+  jackpifm_sample_t *out_a = jackpifm_malloc(out_size * sizeof(jackpifm_sample_t));
+  jackpifm_sample_t *out_b = jackpifm_malloc(out_size * sizeof(jackpifm_sample_t));
+  ring = jackpifm_ring_new(4 * out_size);
+
+  measure_t fused = {0, 0}, unfused = {0, 0}, m;
+  bool identical = true;
+  for (size_t p = 0; p < PERIODS; p++) {
+    for (size_t c = 0; c < 2; c++) {
+      ref[c] = input[c] + p * PERIOD;
+      memcpy(in[c], ref[c], PERIOD * sizeof(jackpifm_sample_t));
+    }
+
+    float reduction = 0;
+    measure_start(&m);
+    size_t count_a = fused_period(pipeline, ref, &reduction);
+    measure_stop(&m);
+    fused.ns += m.ns;
+    fused.cycles += m.cycles;
+    jackpifm_ring_read(ring, out_a, count_a);
+
+    measure_start(&m);
+    size_t count_b = unfused_period(limiter, preemp, resampler, mpx, in, rbuffer);
+    measure_stop(&m);
+    unfused.ns += m.ns;
+    unfused.cycles += m.cycles;
+    jackpifm_ring_read(ring, out_b, count_b);
+
+    if (count_a != count_b || memcmp(out_a, out_b, count_a * sizeof(jackpifm_sample_t)))
+      identical = false;
+  }
+
+  size_t samples = PERIODS * (size_t)(PERIOD / ratio);
+  report("pipeline.unfused", &unfused, samples, RATE);
+  report("pipeline.fused", &fused, samples, RATE);
+  printf("# pipeline: stereo + limiters + preemp + RDS, fused saves %.0f ns per %d-frame period; output %s\n",
+         (unfused.ns - fused.ns) / PERIODS, PERIOD, identical ? "identical" : "DIFFERS");
+
+  jackpifm_pipeline_free(pipeline);
+  for (size_t c = 0; c < 2; c++) {
+    jackpifm_limiter_free(limiter[c]);
+    jackpifm_resamp_free(resampler[c]);
+    free(rbuffer[c]);
+    free(in[c]);
+  }
+  jackpifm_preemp_free(preemp);
+  jackpifm_mpx_free(mpx);
+  jackpifm_ring_free(ring);
+  free(out_a);
+  free(out_b);
+}
+
+// The fused pipeline with the resampling ratio changed every period, as --sync=resamp does
+static void bench_pipeline_adaptive() {
+  jackpifm_pipeline_config_t config = { 2, JRATE, RATE, true, 75e-6, false, 5, 10, rds_blob, sizeof(rds_blob), 0.1, 0.05, 2, 0.001, 0.05, false };
+  jackpifm_pipeline_t *pipeline = jackpifm_pipeline_new(&config);
+  ring = jackpifm_ring_new(4 * PERIOD * RATE / JRATE);
+  jackpifm_sample_t *out = jackpifm_malloc(2 * PERIOD * RATE / JRATE * sizeof(jackpifm_sample_t));
+
+  size_t samples = 0;
+  measure_t m;
+  measure_start(&m);
+  for (size_t p = 0; p < PERIODS; p++) {
+    float reduction = 0;
+    jackpifm_sample_t *in[2] = { input[0] + p * PERIOD, input[1] + p * PERIOD };
+    jackpifm_pipeline_set_factor(pipeline, 1 + ((double)((p * 7919) % 200) - 100) * 1e-6);
+    size_t count = fused_period(pipeline, in, &reduction);
+    jackpifm_ring_read(ring, out, count);
+    samples += count;
+  }
+  measure_stop(&m);
+  report("pipeline.fused.adaptive", &m, samples, RATE);
+
+  jackpifm_pipeline_free(pipeline);
+  jackpifm_ring_free(ring);
+  free(out);
+}
+
+
+// SINGLE STAGES
+// -------------
+
+static void bench_resamp() {
+  static const size_t qualities[] = {3, 5, 8, 16, 32};
+  static const size_t squalities[] = {10, 100, 1000};
+  double ratio = JRATE / (double)RATE;
+  jackpifm_sample_t *out = jackpifm_malloc((PERIOD / ratio + 2) * sizeof(jackpifm_sample_t));
+
+  for (size_t q = 0; q < sizeof(qualities) / sizeof(*qualities); q++)
+    for (size_t sq = 0; sq < sizeof(squalities) / sizeof(*squalities); sq++) {
+      jackpifm_resamp_t *filter = jackpifm_resamp_new(ratio, qualities[q], squalities[sq]);
+      size_t samples = 0;
+      measure_t m;
+      measure_start(&m);
+      for (size_t p = 0; p < PERIODS; p++)
+        samples += jackpifm_resamp_process(filter, out, input[0] + p * PERIOD, PERIOD);
+      measure_stop(&m);
+
+      char name[64];
+      snprintf(name, sizeof(name), "resamp.q%zu.sq%zu", qualities[q], squalities[sq]);
+      report(name, &m, samples, RATE);
+      jackpifm_resamp_free(filter);
+    }
+
+  free(out);
+}
+
+// Pre-emphasis of `channels` at `rate`, per frame
+static void bench_preemp(const char *name, size_t channels, double rate) {
+  jackpifm_preemp_t *filter = jackpifm_preemp_new(channels, rate, 75e-6);
+  jackpifm_sample_t *data[2];
+  for (size_t c = 0; c < channels; c++)
+    data[c] = jackpifm_malloc(PERIOD * sizeof(jackpifm_sample_t));
+  measure_t m = {0, 0}, part;
+
+  for (size_t p = 0; p < PERIODS; p++) {
+    for (size_t c = 0; c < channels; c++)
+      memcpy(data[c], input[c] + p * PERIOD, PERIOD * sizeof(jackpifm_sample_t));
+    measure_start(&part);
+    jackpifm_preemp_process(filter, data, PERIOD);
+    measure_stop(&part);
+    m.ns += part.ns;
+    m.cycles += part.cycles;
+  }
+  report(name, &m, PERIODS * PERIOD, rate);
+
+  jackpifm_preemp_free(filter);
+  for (size_t c = 0; c < channels; c++)
+    free(data[c]);
+}
+
+// Measure the gain of pre-emphasis on sines up to 15kHz, against the analog 1 + s*tau
+// (the right channel gets the sine inverted, and must come out the same but inverted)
+static void check_preemp(double rate, double tau) {
+  size_t size = rate / 10, settle = rate / 100;
+  jackpifm_sample_t *data[2];
+  for (size_t c = 0; c < 2; c++)
+    data[c] = jackpifm_malloc(size * sizeof(jackpifm_sample_t));
+  double worst = 0, worst_freq = 0;
+  bool matched = true;
+
+  for (double freq = 100; freq <= 15000; freq += 100) {
+    jackpifm_preemp_t *filter = jackpifm_preemp_new(2, rate, tau);
+    double w = 2 * M_PI * freq / rate;
+    for (size_t i = 0; i < size; i++) {
+      data[0][i] = 0.1 * sin(w * i);
+      data[1][i] = -data[0][i];
+    }
+    jackpifm_preemp_process(filter, data, size);
+    jackpifm_preemp_free(filter);
+
+    double re = 0, im = 0;
+    for (size_t i = settle; i < size; i++) {
+      re += data[0][i] * cos(w * i);
+      im += data[0][i] * sin(w * i);
+      if (data[1][i] != -data[0][i]) matched = false;
+    }
+    double gain = 2 * hypot(re, im) / (size - settle) / 0.1;
+    double error = 20 * log10(gain / hypot(1, 2 * M_PI * freq * tau));
+    if (fabs(error) > fabs(worst)) {
+      worst = error;
+      worst_freq = freq;
+    }
+  }
+  printf("# preemp %.0fus at %.0fHz: worst deviation from the analog curve up to 15kHz %+.3f dB (at %.0fHz), channels %s\n",
+         tau * 1e6, rate, worst, worst_freq, matched ? "identical" : "DIFFER");
+
+  for (size_t c = 0; c < 2; c++)
+    free(data[c]);
+}
+
+// Stereo limiter over the input scaled by `level`: below 1 it's never over the
+// ceiling and takes the fast path, above it's reducing the gain most of the time
+static void bench_limiter(const char *name, float level) {
+  jackpifm_limiter_t *limiter = jackpifm_limiter_new(2, JRATE, 1, 0.001, 0.05);
+  jackpifm_sample_t *data[2];
+  for (size_t c = 0; c < 2; c++)
+    data[c] = jackpifm_malloc(PERIOD * sizeof(jackpifm_sample_t));
+  measure_t m = {0, 0}, part;
+  float reduction = 0;
+
+  for (size_t p = 0; p < PERIODS; p++) {
+    for (size_t c = 0; c < 2; c++)
+      for (size_t i = 0; i < PERIOD; i++)
+        data[c][i] = level * input[c][p * PERIOD + i];
+    measure_start(&part);
+    jackpifm_limiter_process(limiter, data, PERIOD, &reduction);
+    measure_stop(&part);
+    m.ns += part.ns;
+    m.cycles += part.cycles;
+  }
+  report(name, &m, PERIODS * PERIOD, JRATE);
+  printf("# %s: deepest gain reduction %.1fdB\n", name, reduction);
+
+  jackpifm_limiter_free(limiter);
+  for (size_t c = 0; c < 2; c++)
+    free(data[c]);
+}
+
+static void bench_mpx(const char *name, bool stereo, bool rds) {
+  jackpifm_mpx_config_t config = { stereo, stereo ? 0.45 : 1, 0.1, 0.05, rds ? rds_blob : NULL, sizeof(rds_blob) };
+  jackpifm_mpx_t *mpx = jackpifm_mpx_new(&config);
+  jackpifm_sample_t *data = jackpifm_malloc(PERIOD * sizeof(jackpifm_sample_t));
+  measure_t m;
+
+  // Inputs stand for signals at 152kHz here, only the count matters
+  measure_start(&m);
+  for (size_t p = 0; p < PERIODS; p++)
+    jackpifm_mpx_process(mpx, data, input[0] + p * PERIOD, input[1] + p * PERIOD, PERIOD);
+  measure_stop(&m);
+  report(name, &m, PERIODS * PERIOD, RATE);
+
+  jackpifm_mpx_free(mpx);
+  free(data);
+}
+
+static void bench_controller() {
+  jackpifm_controller_t *ctr = jackpifm_controller_new(1, 8192, 256, 100000, 10000, 15.0, 10000.0, 1*2.0, 1/2.0);
+  size_t calls = 100000;
+  double sum = 0;
+  measure_t m;
+
+  // One call per output period; the delay wanders around the target
+  measure_start(&m);
+  for (size_t i = 0; i < calls; i++)
+    sum += jackpifm_controller_process(ctr, 8192 + (i * 7919) % 1024 - 512);
+  measure_stop(&m);
+  report("controller", &m, calls, RATE / (double)OPERIOD);
+  if (sum == 0) printf("# (controller output was zero)\n");
+
+  jackpifm_controller_free(ctr);
+}
+
+
+// OUTPUTTER
+// ---------
+// The outputter runs against a DMA backend living in RAM, whose DMA jumps
+// half a ring ahead every time the outputter sleeps, so that only the
+// encoding and control block writes are measured. Its pages are resolved
+// from fake pagemap entries that scatter them in reverse order, as the
+// kernel may, so the bus address lookups are exercised too.
+
+#define RAM_FRAME_BASE 0x10000
+
+static size_t ram_block = 0;  // index of the executing block, not counting the first page
+static const uint32_t *ram_bus = NULL;
+
+static void *ram_get_pages(size_t count, uint32_t *baddrs) {
+  void *region;
+  if (posix_memalign(&region, 4096, count * 4096)) abort();
+  memset(region, 0, count * 4096);
+
+  // (only the entries for the region, as jackpifm_pagepool_resolve would read them)
+  uint64_t *entries = jackpifm_malloc(count * sizeof(uint64_t));
+  for (size_t i = 0; i < count; i++)
+    entries[i] = (1ull << 63) | (RAM_FRAME_BASE + 3 * (count - i));
+  int ret = jackpifm_pagepool_decode(entries, count, baddrs);
+  free(entries);
+  if (ret) abort();
+
+  for (size_t i = 0; i < count; i++)
+    assert(baddrs[i] == (RAM_FRAME_BASE + 3 * (count - i)) * 4096);
+  ram_bus = baddrs;
+  return region;
+}
+
+static void ram_free_pages(void *region, size_t count) {
+  free(region);
+}
+
+static void ram_start(uint32_t first_block) {
+  ram_block = 0;
+}
+
+static void ram_stop(void) {
+}
+
+static uint32_t ram_current_block(void) {
+  // The first page holds the clock divider values, not instructions
+  return ram_bus[1 + ram_block / 128] + (ram_block % 128) * 32;
+}
+
+static void ram_now(struct timespec *time) {
+  time->tv_sec = time->tv_nsec = 0;
+}
+
+static void ram_sleep_until(const struct timespec *deadline) {
+  size_t instructions = jackpifm_outputter_buffer_samples() * 4;
+  ram_block = (ram_block + instructions / 2) % instructions;
+}
+
+static const jackpifm_dma_backend_t ram_dma = {
+  ram_get_pages,
+  ram_free_pages,
+  ram_start,
+  ram_stop,
+  ram_current_block,
+  ram_now,
+  ram_sleep_until,
+};
+
+// With `retime`, the rate is changed every period as --sync=dma does
+static void bench_outputter(const char *name, bool retime, bool fixed) {
+  jackpifm_outputter_set_backend(&ram_dma);
+  jackpifm_outputter_setup(RATE, OPERIOD);
+  jackpifm_outputter_fixed(fixed);
+  jackpifm_setup_dma(103.3, JACKPIFM_BUFFERSAMPLES);
+  jackpifm_outputter_sync();
+
+  size_t periods = PERIODS * PERIOD / OPERIOD;
+  measure_t m;
+  measure_start(&m);
+  for (size_t p = 0; p < periods; p++) {
+    if (retime)
+      jackpifm_outputter_setup(RATE / (1 + ((double)((p * 7919) % 200) - 100) * 1e-6), OPERIOD);
+    jackpifm_outputter_output(input[0] + p * OPERIOD, OPERIOD);
+  }
+  measure_stop(&m);
+  report(name, &m, periods * OPERIOD, RATE);
+
+  jackpifm_unsetup_dma();
+  jackpifm_outputter_fixed(false);
+}
+
+
+// ENCODER: float vs fixed point
+// -----------------------------
+// Besides timing both, the emitted signal is decoded back from the control
+// blocks: each sample is the average divider offset over its PWM "LOW" and
+// "HIGH" times (plus the ~2.3 bytes the DMA takes to switch), low-passed to
+// keep the audio band, where the delta-sigma noise doesn't reach.
+
+#define DECODE_WINDOW 16
+
+static void decode(const int *intvals, const unsigned int *lowlens, const unsigned int *fracvals, size_t size, double *out) {
+  double sum = 0;
+  for (size_t i = 0; i < size; i++) {
+    double low = lowlens[i] + 2.3, high = fracvals[i] + 2.3;
+    double value = ((intvals[i] - 1) * low + (intvals[i] + 1) * high) / (low + high) / 8;
+    sum += value;
+    if (i >= DECODE_WINDOW) sum -= out[i - DECODE_WINDOW];
+    out[i] = value;
+    if (i >= DECODE_WINDOW) out[i - DECODE_WINDOW] = sum / DECODE_WINDOW;
+  }
+}
+
+// Power of (a - b) over the decoded range, relative to a full scale sine, in dB
+static double error_db(const double *a, const jackpifm_sample_t *input, const double *b, size_t size) {
+  double sum = 0;
+  size_t n = 0;
+  for (size_t i = 1000; i + DECODE_WINDOW < size; i++, n++) {
+    double ref;
+    if (b) ref = b[i];
+    else {
+      // Low-pass the input the same way; the decoded average lags half a window
+      ref = 0;
+      for (size_t j = 1; j <= DECODE_WINDOW; j++) ref += input[i + j];
+      ref /= DECODE_WINDOW;
+    }
+    sum += (a[i] - ref) * (a[i] - ref);
+  }
+  return 10 * log10(sum / n / 0.5);
+}
+
+static void bench_encoder() {
+  size_t size = PERIODS * PERIOD;
+  int *intvals[2];
+  unsigned int *lowlens[2], *fracvals[2];
+  double *decoded[2];
+  const char *names[2] = { "encoder", "encoder.fixed" };
+
+  jackpifm_outputter_setup(RATE, OPERIOD);
+  for (size_t f = 0; f < 2; f++) {
+    intvals[f] = jackpifm_malloc(size * sizeof(int));
+    lowlens[f] = jackpifm_malloc(size * sizeof(unsigned int));
+    fracvals[f] = jackpifm_malloc(size * sizeof(unsigned int));
+    decoded[f] = jackpifm_malloc(size * sizeof(double));
+
+    jackpifm_outputter_fixed(f);
+    measure_t m;
+    measure_start(&m);
+    jackpifm_outputter_encode(input[0], size, intvals[f], lowlens[f], fracvals[f]);
+    measure_stop(&m);
+    report(names[f], &m, size, RATE);
+    decode(intvals[f], lowlens[f], fracvals[f], size, decoded[f]);
+  }
+  jackpifm_outputter_fixed(false);
+
+  size_t differ = 0;
+  for (size_t i = 0; i < size; i++)
+    if (intvals[0][i] != intvals[1][i] || lowlens[0][i] != lowlens[1][i] || fracvals[0][i] != fracvals[1][i])
+      differ++;
+  printf("# encoder.fixed: %.2f%% of samples encoded differently, in-band deviation from float %.1f dB\n",
+         differ * 100.0 / size, error_db(decoded[1], NULL, decoded[0], size));
+  printf("# encoder error vs input, in band: float %.1f dB, fixed %.1f dB\n",
+         error_db(decoded[0], input[0], NULL, size), error_db(decoded[1], input[0], NULL, size));
+
+  for (size_t f = 0; f < 2; f++) {
+    free(intvals[f]);
+    free(lowlens[f]);
+    free(fracvals[f]);
+    free(decoded[f]);
+  }
+}
+
+
+int main(int argc, char **argv) {
+  open_cycle_counter();
+  if (cycles_fd < 0)
+    printf("# cycle counter not available, cycle figures will be zero\n");
+
+  generate_input(PERIODS * PERIOD);
+
+  printf("# %-30s %10s %14s %9s %10s\n", "name", "ns/sample", "samples/s", "rt%", "cycles");
+  bench_resamp();
+  bench_preemp("preemp.mono", 1, JRATE);
+  bench_preemp("preemp.stereo", 2, JRATE);
+  bench_preemp("preemp.stereo.152k", 2, RATE);
+  check_preemp(44100, 50e-6);
+  check_preemp(JRATE, 50e-6);
+  check_preemp(JRATE, 75e-6);
+  check_preemp(RATE, 50e-6);
+  check_preemp(RATE, 75e-6);
+  bench_limiter("limiter.idle", 0.5);
+  bench_limiter("limiter.active", 2);
+  bench_mpx("mpx.mono+rds", false, true);
+  bench_mpx("mpx.stereo", true, false);
+  bench_mpx("mpx.stereo+rds", true, true);
+  bench_controller();
+  bench_encoder();
+  bench_outputter("outputter", false, false);
+  bench_outputter("outputter.retimed", true, false);
+  bench_outputter("outputter.fixed", false, true);
+  bench_pipeline();
+  bench_pipeline_adaptive();
+
+  for (size_t c = 0; c < 2; c++)
+    free(input[c]);
+  return 0;
+}
@@ -3,7 +3,7 @@
 #ifndef JACKPIFM_COMMON_H
 #define JACKPIFM_COMMON_H
 
-#define _POSIX_C_SOURCE 199309L
+#define _POSIX_C_SOURCE 200112L
 
 #include <stddef.h>
 #include <stdint.h>
@@ -1,6 +1,7 @@
 #include "controller.h"
 
 #include <math.h>
+#include <assert.h>
 
 #define PI 3.14159265358979323846
 
@@ -18,17 +19,27 @@ struct jackpifm_controller_t {
   double max_resample_factor;
   double min_resample_factor;
 
+  /* Smoothing: the offsets are weighted by a Hann window over the last
+   * smooth_size - 1 periods (the current offset gets a zero weight). With
+   * th = 2*PI/(smooth_size-1), the weight of age a is 0.5 - 0.5*Re(e^(j*th*(a-1))),
+   * so the windowed sum is kept as a plain sliding sum plus a complex sliding sum
+   * which is rotated by e^(j*th) on each period. */
+  double rot_re, rot_im;
+  size_t refresh_count;
+
   /* State */
-  double *smooth_offsets;
-  double *window_array;
+  double *smooth_offsets;     /* last smooth_size - 1 offsets, circular */
+  size_t smooth_index;        /* oldest offset in smooth_offsets */
+  double sum;                 /* sum of smooth_offsets */
+  double csum_re, csum_im;    /* complex sum of smooth_offsets */
+  size_t updates;             /* updates since the sums were last recomputed */
   double offset_integral;
-  int offset_differential_index;
   double resample_mean;
 };
 
-inline static double hann(double x) {
-  return 0.5 * (1.0 - cos(2*PI * x));
-}
+/* Recompute the sums from scratch every this many updates, so that rounding
+ * errors can't accumulate */
+#define REFRESH_UPDATES 65536
 
 jackpifm_controller_t *jackpifm_controller_new(
   double static_resample_factor,
@@ -53,12 +64,15 @@ jackpifm_controller_t *jackpifm_controller_new(
   ctr->max_resample_factor = max_resample_factor;
   ctr->min_resample_factor = min_resample_factor;
 
-  ctr->smooth_offsets = jackpifm_calloc(smooth_size, sizeof(double));
-  ctr->window_array = jackpifm_calloc(smooth_size, sizeof(double));
-  for (size_t i = 0; i < smooth_size; i++)
-    ctr->window_array[i] = hann(i / ((double)(smooth_size - 1)));
+  assert(smooth_size >= 2);
+  ctr->rot_re = cos(2*PI / (smooth_size - 1));
+  ctr->rot_im = sin(2*PI / (smooth_size - 1));
+
+  ctr->smooth_offsets = jackpifm_calloc(smooth_size - 1, sizeof(double));
+  ctr->smooth_index = 0;
+  ctr->sum = ctr->csum_re = ctr->csum_im = 0;
+  ctr->updates = 0;
   ctr->offset_integral = 0;
-  ctr->offset_differential_index = 0;
   ctr->resample_mean = static_resample_factor;
 
   return ctr;
@@ -71,20 +85,46 @@ void jackpifm_controller_clear(jackpifm_controller_t *ctr) {
   ctr->offset_integral = - (ctr->resample_mean - ctr->static_resample_factor) * ctr->catch_factor * ctr->catch_factor2;
 
   /* Also clear the array. we are beginning a new control cycle. */
-  memset(ctr->smooth_offsets, 0x00, ctr->smooth_size * sizeof(double));
+  memset(ctr->smooth_offsets, 0x00, (ctr->smooth_size - 1) * sizeof(double));
+  ctr->sum = ctr->csum_re = ctr->csum_im = 0;
+  ctr->updates = 0;
+}
+
+/* Recompute the sums from the stored offsets, oldest (age smooth_size - 1) first */
+static void refresh_sums(jackpifm_controller_t *ctr) {
+  size_t n = ctr->smooth_size - 1;
+  double th = 2*PI / n;
+  ctr->sum = ctr->csum_re = ctr->csum_im = 0;
+  for (size_t k = 0; k < n; k++) {
+    double offset = ctr->smooth_offsets[(ctr->smooth_index + k) % n];
+    size_t age = n - k;
+    ctr->sum += offset;
+    ctr->csum_re += offset * cos(th * (age - 1));
+    ctr->csum_im += offset * sin(th * (age - 1));
+  }
+  ctr->updates = 0;
 }
 
 double jackpifm_controller_process(jackpifm_controller_t *ctr, size_t delay) {
   double offset = (double) delay - ctr->target_delay;
 
-  /* Save offset. */
-  ctr->smooth_offsets[(ctr->offset_differential_index++) % ctr->smooth_size] = offset;
+  /* Build the mean of the windowed offset array basically for lowpassing.
+   * (The current offset has zero weight, so it only goes in afterwards.) */
+  double smooth_offset = (0.5 * ctr->sum - 0.5 * ctr->csum_re) / (double) ctr->smooth_size;
+
+  /* Save offset: it becomes age 1, every other one gets a period older and the
+   * oldest one leaves the window. */
+  double oldest = ctr->smooth_offsets[ctr->smooth_index];
+  ctr->smooth_offsets[ctr->smooth_index] = offset;
+  ctr->smooth_index = (ctr->smooth_index + 1) % (ctr->smooth_size - 1);
 
-  /* Build the mean of the windowed offset array basically for lowpassing. */
-  double smooth_offset = 0.0;
-  for (size_t i = 0; i < ctr->smooth_size; i++)
-    smooth_offset += ctr->smooth_offsets[(i + ctr->offset_differential_index - 1) % ctr->smooth_size] * ctr->window_array[i];
-  smooth_offset /= (double) ctr->smooth_size;
+  ctr->sum += offset - oldest;
+  double re = ctr->rot_re * ctr->csum_re - ctr->rot_im * ctr->csum_im;
+  double im = ctr->rot_im * ctr->csum_re + ctr->rot_re * ctr->csum_im;
+  ctr->csum_re = re + offset - oldest;
+  ctr->csum_im = im;
+  if (++ctr->updates == REFRESH_UPDATES)
+    refresh_sums(ctr);
 
   /* this is the integral of the smoothed_offset */
   ctr->offset_integral += smooth_offset;
@@ -116,7 +156,12 @@ double jackpifm_controller_process(jackpifm_controller_t *ctr, size_t delay) {
   return resample_factor;
 }
 
+double jackpifm_controller_integral(const jackpifm_controller_t *ctr) {
+  return ctr->offset_integral;
+}
+
 void jackpifm_controller_free(jackpifm_controller_t *ctr) {
   if (!ctr) return;
+  free(ctr->smooth_offsets);
   free(ctr);
 }
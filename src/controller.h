@@ -30,6 +30,9 @@ void jackpifm_controller_clear(jackpifm_controller_t *ctr);
 /* jackpifm_controller_process: process a new delay measure and recalculate the coefficient */
 double jackpifm_controller_process(jackpifm_controller_t *ctr, size_t delay);
 
+/* jackpifm_controller_integral: current value of the integral term (sum of smoothed offsets) */
+double jackpifm_controller_integral(const jackpifm_controller_t *ctr);
+
 /* jackpifm_controller_free: deallocate a controller object */
 void jackpifm_controller_free(jackpifm_controller_t *ctr);
 
@@ -0,0 +1,184 @@
+#include "limiter.h"
+
+#include <math.h>
+
+/* Each frame needs a gain of ceiling / peak (at most 1). That's spread over a
+ * window of `length` frames: a sliding minimum over the window, an envelope
+ * with instant attack and exponential release, and a moving average over the
+ * window again. With the signal delayed by length - 1 frames, every frame is
+ * then scaled by at most the gain it needs, and the gain ramps down instead of
+ * stepping.
+ *
+ * Frames go through in blocks: finding the peaks and applying the gain are
+ * branchless loops that get vectorized, and while no frame is over the ceiling
+ * and the gain has recovered, the envelope is skipped and the block is only
+ * delayed. So the cost stays flat and small, limiting or not. */
+#define BLOCK 128
+
+/* The envelope snaps to 1 above this, rather than approaching it forever */
+#define RELEASED 0.9999f
+
+struct jackpifm_limiter_t {
+  size_t channels;
+  size_t length;        /* look-ahead window, in frames */
+  float ceiling;
+  float release;        /* release coefficient per frame */
+
+  /* Delay lines: the last length - 1 frames, followed by the current block */
+  jackpifm_sample_t *line[2];
+
+  /* Sliding minimum of the gains needed: a queue with increasing index and gain */
+  float *queue_gain;
+  uint64_t *queue_index;
+  size_t queue_head, queue_size;
+  uint64_t index;       /* frames processed */
+
+  float envelope;
+  float *window;        /* last `length` values of the envelope */
+  size_t window_pos;
+  double window_sum;
+  size_t window_reduced; /* how many of them are under 1 */
+};
+
+jackpifm_limiter_t *jackpifm_limiter_new(size_t channels, double sample_rate, float ceiling, double lookahead, double release) {
+  jackpifm_limiter_t *limiter = jackpifm_calloc(1, sizeof(jackpifm_limiter_t));
+  size_t length = round(lookahead * sample_rate) + 1;
+  limiter->channels = channels;
+  limiter->length = length;
+  limiter->ceiling = ceiling;
+  limiter->release = 1 - exp(-1 / (release * sample_rate));
+
+  for (size_t c = 0; c < channels; c++)
+    limiter->line[c] = jackpifm_calloc(length - 1 + BLOCK, sizeof(jackpifm_sample_t));
+
+  limiter->queue_gain = jackpifm_calloc(length, sizeof(float));
+  limiter->queue_index = jackpifm_calloc(length, sizeof(uint64_t));
+  limiter->envelope = 1;
+  limiter->window = jackpifm_calloc(length, sizeof(float));
+  for (size_t i = 0; i < length; i++)
+    limiter->window[i] = 1;
+  limiter->window_sum = length;
+  return limiter;
+}
+
+size_t jackpifm_limiter_delay(const jackpifm_limiter_t *limiter) {
+  return limiter->length - 1;
+}
+
+/* Turn the gains needed by `n` frames into the gains to apply, in place */
+static float limiter_envelope(jackpifm_limiter_t *limiter, float *gain, size_t n) {
+  size_t length = limiter->length;
+  float *queue_gain = limiter->queue_gain;
+  uint64_t *queue_index = limiter->queue_index;
+  size_t head = limiter->queue_head, size = limiter->queue_size;
+  float envelope = limiter->envelope, release = limiter->release;
+  float *window = limiter->window;
+  size_t pos = limiter->window_pos, reduced = limiter->window_reduced;
+  double sum = limiter->window_sum, scale = 1.0 / length;
+  float lowest = 1;
+
+  for (size_t i = 0; i < n; i++) {
+    uint64_t index = limiter->index++;
+
+    // Minimum over the window: drop what left it, and what the new gain hides
+    if (size && queue_index[head] + length <= index) {
+      head = (head + 1 == length) ? 0 : head + 1;
+      size--;
+    }
+    size_t tail = head + size;
+    if (tail >= length) tail -= length;
+    while (size && queue_gain[tail ? tail - 1 : length - 1] >= gain[i]) {
+      tail = tail ? tail - 1 : length - 1;
+      size--;
+    }
+    queue_gain[tail] = gain[i];
+    queue_index[tail] = index;
+    size++;
+    float target = queue_gain[head];
+
+    envelope = (target < envelope) ? target : envelope + (target - envelope) * release;
+    if (envelope > RELEASED) envelope = 1;
+
+    // Moving average of the envelope
+    float old = window[pos];
+    window[pos] = envelope;
+    pos = (pos + 1 == length) ? 0 : pos + 1;
+    reduced += (envelope < 1) - (old < 1);
+    sum = reduced ? sum + envelope - old : length;
+
+    gain[i] = sum * scale;
+    if (gain[i] < lowest) lowest = gain[i];
+  }
+
+  limiter->queue_head = head;
+  limiter->queue_size = size;
+  limiter->envelope = envelope;
+  limiter->window_pos = pos;
+  limiter->window_sum = sum;
+  limiter->window_reduced = reduced;
+  return lowest;
+}
+
+void jackpifm_limiter_process(jackpifm_limiter_t *limiter, jackpifm_sample_t *const *data, size_t size, float *reduction) {
+  size_t channels = limiter->channels, delay = limiter->length - 1;
+  float ceiling = limiter->ceiling;
+  float peak[BLOCK];
+  float lowest = 1;
+
+  for (size_t offset = 0; offset < size; offset += BLOCK) {
+    size_t n = size - offset;
+    if (n > BLOCK) n = BLOCK;
+
+    // Append the block to the delay lines, and find the peak of each frame
+    for (size_t c = 0; c < channels; c++)
+      memcpy(limiter->line[c] + delay, data[c] + offset, n * sizeof(jackpifm_sample_t));
+    const jackpifm_sample_t *left = limiter->line[0] + delay, *right = limiter->line[channels - 1] + delay;
+    float highest = 0;
+    for (size_t i = 0; i < n; i++) {
+      float l = fabsf(left[i]), r = fabsf(right[i]);
+      peak[i] = (l > r) ? l : r;
+      highest = (peak[i] > highest) ? peak[i] : highest;
+    }
+
+    if (highest <= ceiling && limiter->envelope == 1 && !limiter->window_reduced) {
+      // Nothing to limit, only delay (the queue held nothing but gains of 1)
+      limiter->queue_size = 0;
+      limiter->index += n;
+      for (size_t c = 0; c < channels; c++)
+        memcpy(data[c] + offset, limiter->line[c], n * sizeof(jackpifm_sample_t));
+    } else {
+      // (a silent frame needs an infinite gain, which is clamped to 1 too)
+      for (size_t i = 0; i < n; i++) {
+        float gain = ceiling / peak[i];
+        peak[i] = (gain < 1) ? gain : 1;
+      }
+      float block_lowest = limiter_envelope(limiter, peak, n);
+      if (block_lowest < lowest) lowest = block_lowest;
+
+      for (size_t c = 0; c < channels; c++) {
+        const jackpifm_sample_t *line = limiter->line[c];
+        jackpifm_sample_t *out = data[c] + offset;
+        for (size_t i = 0; i < n; i++)
+          out[i] = line[i] * peak[i];
+      }
+    }
+
+    for (size_t c = 0; c < channels; c++)
+      memmove(limiter->line[c], limiter->line[c] + n, delay * sizeof(jackpifm_sample_t));
+  }
+
+  if (lowest < 1) {
+    float db = -20 * log10f(lowest);
+    if (db > *reduction) *reduction = db;
+  }
+}
+
+void jackpifm_limiter_free(jackpifm_limiter_t *limiter) {
+  if (!limiter) return;
+  for (size_t c = 0; c < limiter->channels; c++)
+    free(limiter->line[c]);
+  free(limiter->queue_gain);
+  free(limiter->queue_index);
+  free(limiter->window);
+  free(limiter);
+}
@@ -0,0 +1,34 @@
+/* limiter.h - look-ahead peak limiter, with the gain linked across channels */
+
+#ifndef JACKPIFM_LIMITER_H
+#define JACKPIFM_LIMITER_H
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct jackpifm_limiter_t jackpifm_limiter_t;
+
+/* jackpifm_limiter_new: create new limiter keeping `channels` (1 or 2) under `ceiling`.
+ *                       The gain reaches its target over `lookahead` seconds, which is
+ *                       also how much the signal is delayed, and recovers with a
+ *                       `release` seconds time constant. */
+jackpifm_limiter_t *jackpifm_limiter_new(size_t channels, double sample_rate, float ceiling, double lookahead, double release) __attribute__((malloc));
+
+/* jackpifm_limiter_delay: frames the signal is delayed by */
+size_t jackpifm_limiter_delay(const jackpifm_limiter_t *limiter);
+
+/* jackpifm_limiter_process: limit `size` frames of each channel in place. If the gain was
+ *                           reduced by more than `*reduction` dB, it's set to that. */
+void jackpifm_limiter_process(jackpifm_limiter_t *limiter, jackpifm_sample_t *const *data, size_t size, float *reduction);
+
+/* jackpifm_limiter_free: deallocate a limiter */
+void jackpifm_limiter_free(jackpifm_limiter_t *limiter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JACKPIFM_LIMITER_H */
@@ -0,0 +1,163 @@
+#include "logger.h"
+
+#include <pthread.h>
+#include <time.h>
+
+/* How often the logger thread wakes up to empty the queue */
+#define LOGGER_POLL_NS 100000000
+
+#define CACHE_LINE 64
+
+/* Bounded multi-producer queue: each slot has a sequence number telling whether
+ * it's free for position `pos` (seq == pos) or holds the event for it (seq == pos + 1).
+ * Producers claim positions by advancing `tail`; there's only one consumer. */
+typedef struct {
+  size_t seq;
+  uint32_t event;
+  uint64_t value;
+} slot_t;
+
+typedef struct {
+  uint64_t count;       // events coalesced so far
+  uint64_t total;       // sum of their values
+  double last_print;    // time it was last printed
+} pending_t;
+
+struct jackpifm_logger_t {
+  size_t tail;  /* claimed by producers */
+  char pad0[CACHE_LINE - sizeof(size_t)];
+  size_t head;  /* only used by the consumer */
+  uint64_t lost;  /* [atomic] events that didn't fit */
+  char pad1[CACHE_LINE - sizeof(size_t) - sizeof(uint64_t)];
+
+  size_t mask;
+  slot_t *slots;
+
+  double interval;
+  pending_t pending[JACKPIFM_LOG_EVENTS];
+  bool running; /* [atomic] */
+  pthread_t thread;
+};
+
+/* Messages, receiving the total value of the coalesced events */
+static const char *const messages[JACKPIFM_LOG_EVENTS] = {
+  "Got too many frames from JACK, dropped %llu frames",
+  "Limiting the gain over %llu frames",
+  "The buffer got empty, delaying! Missed %llu samples",
+};
+
+static double now_seconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+void jackpifm_logger_push(jackpifm_logger_t *logger, jackpifm_log_event_t event, uint64_t value) {
+  size_t pos = __atomic_load_n(&logger->tail, __ATOMIC_RELAXED);
+  slot_t *slot;
+
+  while (1) {
+    slot = &logger->slots[pos & logger->mask];
+    size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    ptrdiff_t diff = (ptrdiff_t)(seq - pos);
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&logger->tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    } else if (diff < 0) {
+      __atomic_fetch_add(&logger->lost, 1, __ATOMIC_RELAXED);
+      return;
+    } else pos = __atomic_load_n(&logger->tail, __ATOMIC_RELAXED);
+  }
+
+  slot->event = event;
+  slot->value = value;
+  __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+/* Move queued events into the pending counters */
+static void logger_drain(jackpifm_logger_t *logger) {
+  while (1) {
+    slot_t *slot = &logger->slots[logger->head & logger->mask];
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != logger->head + 1) break;
+
+    pending_t *pending = &logger->pending[slot->event];
+    pending->count++;
+    pending->total += slot->value;
+
+    __atomic_store_n(&slot->seq, logger->head + logger->mask + 1, __ATOMIC_RELEASE);
+    logger->head++;
+  }
+}
+
+/* Print the pending counters that haven't been printed for `interval` (or all, if `force`) */
+static void logger_print(jackpifm_logger_t *logger, bool force) {
+  double now = now_seconds();
+
+  for (size_t e = 0; e < JACKPIFM_LOG_EVENTS; e++) {
+    pending_t *pending = &logger->pending[e];
+    if (!pending->count || (!force && now - pending->last_print < logger->interval)) continue;
+
+    // The first event after a quiet interval is printed right away, the rest coalesced
+    fprintf(stderr, messages[e], (unsigned long long)pending->total);
+    if (pending->count > 1)
+      fprintf(stderr, " (%llu times)", (unsigned long long)pending->count);
+    if (now - pending->last_print < 2 * logger->interval)
+      fprintf(stderr, " in the last %.1fs", now - pending->last_print);
+    fprintf(stderr, ".\n");
+
+    pending->count = pending->total = 0;
+    pending->last_print = now;
+  }
+
+  uint64_t lost = __atomic_exchange_n(&logger->lost, 0, __ATOMIC_RELAXED);
+  if (lost) fprintf(stderr, "Log queue full, %llu events lost.\n", (unsigned long long)lost);
+}
+
+static void *logger_thread(void *arg) {
+  jackpifm_logger_t *logger = arg;
+  struct timespec poll = { 0, LOGGER_POLL_NS };
+
+  while (__atomic_load_n(&logger->running, __ATOMIC_ACQUIRE)) {
+    nanosleep(&poll, NULL);
+    logger_drain(logger);
+    logger_print(logger, false);
+  }
+
+  return NULL;
+}
+
+jackpifm_logger_t *jackpifm_logger_new(size_t capacity, double interval) {
+  jackpifm_logger_t *logger = jackpifm_calloc(1, sizeof(jackpifm_logger_t));
+  size_t real_size = 1;
+  while (real_size < capacity) real_size <<= 1;
+
+  logger->mask = real_size - 1;
+  logger->slots = jackpifm_calloc(real_size, sizeof(slot_t));
+  for (size_t i = 0; i < real_size; i++)
+    logger->slots[i].seq = i;
+
+  logger->interval = interval;
+  for (size_t e = 0; e < JACKPIFM_LOG_EVENTS; e++)
+    logger->pending[e].last_print = -interval * 2;
+
+  // The thread is created with the default (non real-time) scheduling
+  logger->running = true;
+  int ret = pthread_create(&logger->thread, NULL, logger_thread, logger);
+  if (ret) {
+    fprintf(stderr, "Couldn't create logger thread.\n");
+    abort();
+  }
+  return logger;
+}
+
+void jackpifm_logger_free(jackpifm_logger_t *logger) {
+  if (!logger) return;
+
+  __atomic_store_n(&logger->running, false, __ATOMIC_RELEASE);
+  pthread_join(logger->thread, NULL);
+  logger_drain(logger);
+  logger_print(logger, true);
+
+  free(logger->slots);
+  free(logger);
+}
@@ -0,0 +1,40 @@
+/* logger.h - real-time safe event logging */
+
+#ifndef JACKPIFM_LOGGER_H
+#define JACKPIFM_LOGGER_H
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct jackpifm_logger_t jackpifm_logger_t;
+
+/* Events the real-time threads can report; each carries a value */
+typedef enum {
+  JACKPIFM_LOG_DROPPED,   // frames from JACK dropped because the ringbuffer was full
+  JACKPIFM_LOG_LIMITED,   // the limiters reduced the gain (value is the period's frames)
+  JACKPIFM_LOG_UNDERRUN,  // the ringbuffer got empty (value is the missing samples)
+  JACKPIFM_LOG_EVENTS
+} jackpifm_log_event_t;
+
+/* jackpifm_logger_new: preallocate a queue of `capacity` events and start the
+ *                      thread that prints them. Events of the same kind are
+ *                      coalesced so that each kind is printed at most once
+ *                      every `interval` seconds. */
+jackpifm_logger_t *jackpifm_logger_new(size_t capacity, double interval) __attribute__((malloc));
+
+/* jackpifm_logger_push: report an event. Lock-free, doesn't allocate nor make
+ *                       syscalls, and can be called from any number of threads.
+ *                       If the queue is full the event is only counted as lost. */
+void jackpifm_logger_push(jackpifm_logger_t *logger, jackpifm_log_event_t event, uint64_t value);
+
+/* jackpifm_logger_free: print pending events, stop the thread and deallocate */
+void jackpifm_logger_free(jackpifm_logger_t *logger);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JACKPIFM_LOGGER_H */
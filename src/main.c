@@ -1,22 +1,30 @@
+#define _GNU_SOURCE
 #include "common.h"
 #include "assert.h"
 
 #include <unistd.h>
 #include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <signal.h>
 #include <errno.h>
 #include <math.h>
 
 #include "controller.h"
-#include "preemp.h"
-#include "stereo.h"
-#include "rds.h"
+#include "logger.h"
+#include "pipeline.h"
 #include "outputter.h"
-#include "resamp.h"
+#include "simdma.h"
+#include "ring.h"
+#include "telemetry.h"
 
 
 // Following is a graph of the flow the samples follow
-// to get from JACK to the GPIO (filters not shown):
+// to get from JACK to the GPIO (filters not shown, they run
+// fused with resampling, see pipeline.h):
 //
 //
 //                           |ipos            |opos
@@ -31,9 +39,12 @@
 //            JACK thread                  our thread
 //
 //
-// `jperiod` and `operiod` are fixed parameters.
+// `operiod` is a fixed parameter; `jperiod` is whatever JACK uses, and
+// may change at runtime (see RECONFIGURATION).
 // `jrate` and `rate` are theoretical, or target, sample rates.
 // `ipos` and `opos` track the tail and head of the ringbuffer.
+// The ringbuffer is wait-free (see ring.h), so neither thread ever
+// blocks the other.
 //
 // A more precise explanation follows.
 //
@@ -47,7 +58,7 @@
 //
 // 3. The new samples are written to the ringbuffer, and `ipos`
 //    incremented accordingly. If the ringbuffer is full, the samples
-//    are dropped instead and a message printed.
+//    are dropped instead and the logger thread notified (see logger.h).
 //
 // 4. At the same time, another thread is constantly reading samples
 //    from the ringbuffer, in groups of `operiod` samples, and updating
@@ -58,218 +69,541 @@
 //
 // In order to fix the desync from both sides, the following is done:
 //
-//  - The reading thread is started only after at least `delay` samples
-//    have been written to the ringbuffer.
+//  - The reading thread waits (on an eventfd) until at least `delay`
+//    samples have been written to the ringbuffer.
 //
 //  - The program should try to adjust the GPIO, making it read faster
 //    or slower, so that there's on average `delay` samples of difference
 //    between what is written to the ringbuffer, and what is read from it.
 //
 // This last step is done through a custom PI controller.
+//
+// With --sync=resamp the GPIO rate stays fixed instead, and the controller's
+// coefficient is handed to the JACK thread, which scales the resampling ratio
+// by it, so the RESAMPLING step produces more or fewer samples. The outputter
+// then never changes its timing, and the correction is much finer.
+//
+// With --direct there's no RINGBUFFER nor output thread: the JACK thread
+// encodes each period straight into the DMA control blocks, keeping them
+// `delay` samples ahead of the DMA, and the controller works on that lead
+// instead of the ringbuffer fill (see DIRECT MODE).
 
 
-// Integer parameters (measures in samples)
-static size_t ringsize; // Size of the ring buffer.
-static size_t jperiod;  // Period size at which we receive from JACK.
-static size_t operiod;  // Period size at which we read from the ringbuffer.
-static size_t jrate;    // "Theoretical" rate at which we read from JACK.
-static size_t rate;     // "Theoretical" target rate at which we write to the GPIO.
-static size_t delay;    // Initial/target delay between writing and reading to ringbuffer.
-static size_t min_lat;  // Minimum latency in JACK frames, from reading from JACK until emitting over FM.
-static size_t tar_lat;  // Target latency in JACK frames, from reading from JACK until emitting over FM, which we try to approximate.
-static size_t max_lat;  // Maximum latency in JACK frames, from reading from JACK until emitting over FM.
+#include "options.c"
 
-static volatile size_t ipos;       // Input position inside the ring buffer (i.e. where to write next). [mutex]
-static volatile size_t opos;       // Output position inside the ring buffer (i.e. where to read next). [mutex]
+
+// A JACK period written to the ringbuffer, followed to measure its latency
+typedef struct {
+  uint64_t pos;   // position of its first sample in the chain's sample stream
+  uint64_t time;  // when JACK's cycle for it started (CLOCK_MONOTONIC, in ns)
+} latency_tag_t;
+
+#define LATENCY_TAGS 64
+
+// Everything that depends on JACK's buffer size and sample rate lives in a
+// chain, so it can be rebuilt when JACK is reconfigured (see RECONFIGURATION).
+// Measures are in samples unless noted.
+typedef struct chain_t {
+  size_t jperiod;  // Period size at which we receive from JACK.
+  size_t jrate;    // "Theoretical" rate at which we read from JACK.
+  size_t rate;     // "Theoretical" target rate at which we write to the GPIO.
+  size_t ringsize; // Size of the ring buffer (a power of two), 0 in direct mode.
+  size_t delay;    // Initial/target delay between writing and reading to ringbuffer (or lead over the DMA, in direct mode).
+  size_t min_lat;  // Minimum latency in JACK frames, from reading from JACK until emitting over FM.
+  size_t tar_lat;  // Target latency in JACK frames, from reading from JACK until emitting over FM, which we try to approximate.
+  size_t max_lat;  // Maximum latency in JACK frames, from reading from JACK until emitting over FM.
+  size_t filter_delay; // JACK frames the pipeline holds back (the limiters' look-ahead), included in the above.
+
+  jackpifm_pipeline_t *pipeline;
+  jackpifm_ring_t *ringbuffer;
+  jackpifm_sample_t *dbuffer; // in direct mode, where each period is processed into
+  jackpifm_controller_t *controller;
+  uint64_t factor; // [atomic] bits of the (double) resampling factor set by the controller, with --sync=resamp
+
+  // Latency tags, from the JACK thread to the output thread (see LATENCY MEASUREMENT)
+  latency_tag_t tags[LATENCY_TAGS];
+  size_t tags_in;   // [atomic] tags pushed
+  size_t tags_out;  // [atomic] tags popped
+  uint64_t written; // samples written to the ringbuffer (only touched by the JACK thread)
+  uint64_t read;    // samples read from it (only touched by the output thread)
+
+  struct chain_t *next; // [atomic] chain the JACK thread moved on to, if any
+} chain_t;
+
+// Fixed parameters
+static size_t operiod;  // Period size at which we read from the ringbuffer.
+static size_t channels;
+static bool sync_resamp; // drift is absorbed by the resampler, the DMA rate is fixed
+static bool direct;      // the JACK thread writes straight to the DMA, see DIRECT MODE
+static const client_options *options;
+
+// Chains
+static chain_t *jack_chain;    // Chain the JACK thread writes to (only touched by it)
+static chain_t *output_chain;  // [atomic] Chain the output thread reads from
+static chain_t *next_chain;    // [atomic] Chain built for the new JACK setup, not yet picked up
+static chain_t *oldest_chain;  // First chain not freed yet (only touched by the main thread)
+static chain_t *latest_chain;  // Last chain built (only touched by the main thread)
+static size_t target_latency;  // [atomic] tar_lat of the latest chain, reported to JACK until measured
+static size_t measured_latency; // [atomic] measured latency in JACK frames to report, 0 if none yet
+static size_t reported_latency; // last latency reported to JACK (only touched by the main thread)
+static size_t jack_jperiod;    // [atomic] Buffer size JACK last told us about
+static size_t jack_jrate;      // [atomic] Sample rate JACK last told us about
 
 // Other parameters
 static jack_client_t *jack_client;
 static jack_port_t *jack_ports[2];
 static pthread_t thread;
-static pthread_mutex_t mutex;
-static jackpifm_preemp_t **preemp;
-static jackpifm_stereo_t *stereo;
+static int wakeup_fd;   // eventfd the output thread waits on before starting
+static int control_fd;  // eventfd the main thread waits on for reconfigurations
 static const uint8_t *rds_data;
-static jackpifm_rds_t *rds;
-static jackpifm_resamp_t *resampler [2];
-static jackpifm_sample_t *resampler_buffer [2];
+static size_t rds_size;
 static jackpifm_sample_t *obuffer;
-static jackpifm_sample_t *ringbuffer; // [mutex]
-static jackpifm_controller_t *controller;
-static volatile bool thread_started; // [mutex]
-static volatile bool thread_running; // [mutex]
+static jackpifm_logger_t *logger; // the real-time threads must log through here
+static bool verify_encoder;
+static struct timespec output_start; // when the output thread started emitting
+static bool thread_started; // [atomic] the output thread has been woken up
+static bool thread_running; // [atomic]
+static jackpifm_telemetry_t *telemetry; // NULL if not publishing
+static const char *telemetry_name;
+static jackpifm_telemetry_input_t input_stats;   // only touched by the JACK thread
+static jackpifm_telemetry_output_t output_stats; // only touched by the output thread (or the JACK thread, in direct mode)
+static uint64_t major_faults_base, minor_faults_base; // page faults before activation
+
+
+// LATENCY MEASUREMENT
+// -------------------
+// Each JACK period is tagged with the time its cycle started. The tag follows
+// the period's first sample through the ringbuffer (in a queue next to it) and
+// into the outputter, which notes when the DMA goes past it. The difference is
+// the real latency, from JACK to the antenna: it's kept in a histogram (printed
+// on exit), and a smoothed value is reported to JACK whenever it moves away
+// from the last one reported by more than half a period.
+
+#define LATENCY_BUCKET_NS 100000   // histogram resolution
+#define LATENCY_BUCKETS 10000      // (the last one holds everything above 1s)
+#define LATENCY_SMOOTH 16          // smoothing of the reported latency, in measures
+
+static uint32_t latency_histogram[LATENCY_BUCKETS]; // only touched by the emitting thread
+static uint64_t latency_count;
+static double latency_smooth;  // in ns
+
+static void notify(int fd);
+
+// When the audio the pipeline outputs this period was read: the current JACK cycle's start
+// minus what the pipeline holds back, in CLOCK_MONOTONIC ns (JACK's own clock may differ)
+static uint64_t cycle_start_time(const chain_t *chain) {
+  jack_time_t start = jack_frames_to_time(jack_client, jack_last_frame_time(jack_client) - chain->filter_delay);
+  int64_t ago = (int64_t)(jack_get_time() - start) * 1000;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000ull + now.tv_nsec - (ago > 0 ? ago : 0);
+}
 
+// (JACK thread) tag the period about to be written at the chain's write position
+static void push_tag(chain_t *chain, uint64_t time) {
+  size_t in = chain->tags_in;
+  if (in - __atomic_load_n(&chain->tags_out, __ATOMIC_ACQUIRE) < LATENCY_TAGS) {
+    chain->tags[in % LATENCY_TAGS] = (latency_tag_t) { chain->written, time };
+    __atomic_store_n(&chain->tags_in, in + 1, __ATOMIC_RELEASE);
+  }
+}
 
-// JACK CALLBACKS
-// --------------
+// (output thread) mark the tagged samples among the next `count` read from the chain
+static void mark_tags(chain_t *chain, size_t count) {
+  size_t in = __atomic_load_n(&chain->tags_in, __ATOMIC_ACQUIRE);
+  size_t out = chain->tags_out;
+  for (; out != in; out++) {
+    const latency_tag_t *tag = &chain->tags[out % LATENCY_TAGS];
+    if (tag->pos >= chain->read + count) break;
+    if (tag->pos >= chain->read) jackpifm_outputter_mark(tag->pos - chain->read, tag->time);
+  }
+  __atomic_store_n(&chain->tags_out, out, __ATOMIC_RELEASE);
+  chain->read += count;
+}
 
-void *output_thread(void *arg);
+// Collect the marks the DMA has emitted
+static void record_latencies(const chain_t *chain) {
+  uint64_t time, emitted;
+  while (jackpifm_outputter_poll_mark(&time, &emitted)) {
+    double latency = emitted > time ? emitted - time : 0;
+    size_t bucket = latency / LATENCY_BUCKET_NS;
+    latency_histogram[bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1]++;
+    latency_smooth = latency_count ? latency_smooth + (latency - latency_smooth) / LATENCY_SMOOTH : latency;
+    latency_count++;
+
+    size_t frames = round(latency_smooth * chain->jrate / 1e9);
+    size_t last = __atomic_load_n(&measured_latency, __ATOMIC_RELAXED);
+    if (!last || frames > last + chain->jperiod / 2 || frames + chain->jperiod / 2 < last) {
+      __atomic_store_n(&measured_latency, frames, __ATOMIC_RELAXED);
+      // (in direct mode this is the JACK thread, which makes no syscalls: the
+      // control loop picks it up on its next watchdog check instead)
+      if (!direct) notify(control_fd);
+    }
+  }
+  output_stats.latency_ns = latency_smooth;
+}
 
-// Utility method
-inline void crop_sample(jackpifm_sample_t *sample, size_t *cropped) {
-  if (*sample < -1) {
-    *sample = -1;
-    (*cropped)++;
-  } else if (*sample > +1) {
-    *sample = +1;
-    (*cropped)++;
+// Print the histogram's summary
+static void print_latencies() {
+  if (!latency_count) return;
+  double percentiles[] = { 0, 0.5, 0.99, 1 };
+  double values[4];
+  uint64_t seen = 0;
+  size_t p = 0;
+  for (size_t b = 0; b < LATENCY_BUCKETS && p < 4; b++) {
+    seen += latency_histogram[b];
+    while (p < 4 && seen && seen >= ceil(percentiles[p] * latency_count))
+      values[p++] = (b + 0.5) * LATENCY_BUCKET_NS / 1e6;
   }
+  printf("Info: measured latency over %llu periods: min %.1fms, median %.1fms, 99%% %.1fms, max %.1fms.\n",
+         (unsigned long long)latency_count, values[0], values[1], values[2], values[3]);
 }
 
-// The main "process" callback. We receive samples from Jack,
-// preprocess them and write them to the ringbuffer.
-int process_callback(jack_nframes_t nframes, void *arg) {
-  jackpifm_sample_t *ibuffer;
-  size_t iperiod;
-  size_t cropped_now = 0;
-
-  // Preemp, resample and stereo modulate
-  if (stereo) {
-    jackpifm_sample_t *left = jack_port_get_buffer(jack_ports[0], jperiod);
-    jackpifm_sample_t *right = jack_port_get_buffer(jack_ports[1], jperiod);
-    iperiod = jperiod;
-
-    for (size_t i = 0; i < iperiod; i++) {
-      crop_sample(left + i, &cropped_now);
-      crop_sample(right + i, &cropped_now);
-    }
 
-    if (preemp) {
-      jackpifm_preemp_process(preemp[0], left, iperiod);
-      jackpifm_preemp_process(preemp[1], right, iperiod);
-    }
+// JACK CALLBACKS
+// --------------
 
-    // We assume resampling is enabled
-    size_t result = jackpifm_resamp_process(resampler[0], resampler_buffer[0], left, iperiod);
-    size_t result_b = jackpifm_resamp_process(resampler[1], resampler_buffer[1], right, iperiod);
-    // Since both resamplers are fed the same number
-    // of samples at the same time, it's safe to assume
-    // they always return the same number of samples.
-    assert(result == result_b);
-    left = resampler_buffer[0];
-    right = resampler_buffer[1];
-    iperiod = result;
-
-    jackpifm_stereo_process(stereo, resampler_buffer[0], left, right, iperiod);
-    ibuffer = resampler_buffer[0];
-  } else {
-    ibuffer = jack_port_get_buffer(jack_ports[0], jperiod);
-    iperiod = jperiod;
+void *output_thread(void *arg);
+
+static void notify(int fd) {
+  uint64_t one = 1;
+  ssize_t ret = write(fd, &one, sizeof(one));
+  assert(ret == sizeof(one));
+}
 
-    for (size_t i = 0; i < iperiod; i++)
-      crop_sample(ibuffer + i, &cropped_now);
+// JACK has been reconfigured and the chain will be replaced
+static bool stale_chain(const chain_t *chain) {
+  return chain->jperiod != __atomic_load_n(&jack_jperiod, __ATOMIC_RELAXED) ||
+         chain->jrate != __atomic_load_n(&jack_jrate, __ATOMIC_RELAXED);
+}
 
-    if (preemp)
-      jackpifm_preemp_process(preemp[0], ibuffer, iperiod);
+void direct_output(chain_t *chain, jackpifm_sample_t *const *in, size_t nframes, float *reduction);
+static void update_faults();
 
-    if (resampler[0]) {
-      size_t result = jackpifm_resamp_process(resampler[0], resampler_buffer[0], ibuffer, iperiod);
-      ibuffer = resampler_buffer[0];
-      iperiod = result;
+// The main "process" callback. We receive samples from Jack,
+// preprocess them and write them to the ringbuffer.
+int process_callback(jack_nframes_t nframes, void *arg) {
+  jackpifm_sample_t *in[2];
+  float reduction_now = 0;
+  struct timespec start;
+  if (telemetry) clock_gettime(CLOCK_MONOTONIC, &start);
+
+  // Move on to a new chain if JACK was reconfigured; the output thread
+  // will follow once it has emitted what's left in the old one
+  chain_t *next = __atomic_exchange_n(&next_chain, NULL, __ATOMIC_ACQ_REL);
+  if (next) {
+    __atomic_store_n(&jack_chain->next, next, __ATOMIC_RELEASE);
+    jack_chain = next;
+    if (direct) {
+      // (there's no output thread to follow, the old chain can go now; the
+      // control loop picks that up on its next watchdog check)
+      __atomic_store_n(&output_chain, next, __ATOMIC_RELEASE);
     }
   }
+  chain_t *chain = jack_chain;
 
-  // Apply RDS encoding (if needed)
-  if (rds)
-    // We assume resampling is enabled
-    jackpifm_rds_process(rds, ibuffer, iperiod);
+  // Until the new chain is built, periods in the new setup are dropped
+  if (nframes != chain->jperiod || stale_chain(chain)) {
+    input_stats.dropped++;
+    return 0;
+  }
 
+  for (size_t c = 0; c < channels; c++)
+    in[c] = jack_port_get_buffer(jack_ports[c], nframes);
 
-  pthread_mutex_lock(&mutex);
-  if (!thread_running) {
-    pthread_mutex_unlock(&mutex);
-    return 0;
+  if (direct) {
+    direct_output(chain, in, nframes, &reduction_now);
+    goto done;
   }
 
-  // Check that we don't overwrite
-  if ((ringsize + ipos - opos) % ringsize <= ringsize - iperiod) {
-    // Write to ringbuffer
-    if (ipos + iperiod > ringsize) {
-      size_t delta = ringsize - ipos;
-      memcpy(ringbuffer + ipos, ibuffer, delta * sizeof(jackpifm_sample_t));
-      memcpy(ringbuffer, ibuffer + delta, (iperiod - delta) * sizeof(jackpifm_sample_t));
-    } else memcpy(ringbuffer + ipos, ibuffer, iperiod * sizeof(jackpifm_sample_t));
+  // Preemp, resample, stereo modulate and RDS encode, writing
+  // straight to the ringbuffer (unless it would overwrite)
+  bool running = __atomic_load_n(&thread_running, __ATOMIC_ACQUIRE);
+  if (sync_resamp) {
+    uint64_t bits = __atomic_load_n(&chain->factor, __ATOMIC_RELAXED);
+    double factor;
+    memcpy(&factor, &bits, sizeof(factor));
+    jackpifm_pipeline_set_factor(chain->pipeline, factor);
+  }
+  size_t iperiod = jackpifm_pipeline_count(chain->pipeline, nframes);
+  jackpifm_sample_t *out = running ? jackpifm_ring_write_begin(chain->ringbuffer, iperiod) : NULL;
+  bool fits = out != NULL;
+  jackpifm_pipeline_process(chain->pipeline, in, nframes, out, &reduction_now);
+  if (fits) {
+    push_tag(chain, cycle_start_time(chain));
+    chain->written += iperiod;
+    jackpifm_ring_write_commit(chain->ringbuffer, iperiod);
+  }
 
-    ipos = (ipos + iperiod) % ringsize;
+  if (!running)
+    return 0;
 
-    // Start thread
-    if (!thread_started) {
-      int ret = pthread_create(&thread, NULL, output_thread, NULL);
-      assert(!ret);
-      thread_started = true;
+  if (fits) {
+    // Wake up the thread once there's enough delay
+    if (!__atomic_load_n(&thread_started, __ATOMIC_RELAXED) && jackpifm_ring_fill(chain->ringbuffer) >= chain->delay) {
+      __atomic_store_n(&thread_started, true, __ATOMIC_RELAXED);
+      notify(wakeup_fd);
     }
   } else {
-    fprintf(stderr, "Got too many frames from JACK, dropping :(\n");
+    jackpifm_logger_push(logger, JACKPIFM_LOG_DROPPED, nframes);
+    input_stats.dropped++;
+  }
+
+done:
+  if (reduction_now > 0) {
+    jackpifm_logger_push(logger, JACKPIFM_LOG_LIMITED, nframes);
+    input_stats.limited += nframes;
   }
 
-  if (cropped_now) fprintf(stderr, "Cropped %u samples.\n", cropped_now);
-  pthread_mutex_unlock(&mutex);
+  input_stats.periods++;
+  input_stats.reduction_db = reduction_now;
+  if (reduction_now > input_stats.reduction_max_db)
+    input_stats.reduction_max_db = reduction_now;
+  if (telemetry) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    input_stats.process_ns = (end.tv_sec - start.tv_sec) * 1000000000ull + end.tv_nsec - start.tv_nsec;
+    if (input_stats.process_ns > input_stats.process_max_ns)
+      input_stats.process_max_ns = input_stats.process_ns;
+    jackpifm_telemetry_publish_input(telemetry, &input_stats);
+  }
 
   return 0;
 }
 
+// JACK is being reconfigured: let the main thread build a new chain
 int buffer_size_callback(jack_nframes_t nframes, void *arg) {
-  if (nframes != jperiod) {
-    fprintf(stderr, "Sorry, JACK buffer size changed and I can't take that.\n");
-    exit(1);
-  }
+  __atomic_store_n(&jack_jperiod, nframes, __ATOMIC_RELAXED);
+  notify(control_fd);
   return 0;
 }
 int sample_rate_callback(jack_nframes_t nframes, void *arg) {
-  if (nframes != jrate) {
-    fprintf(stderr, "Sorry, JACK sample rate changed and I can't take that.\n");
-    exit(1);
-  }
+  __atomic_store_n(&jack_jrate, nframes, __ATOMIC_RELAXED);
+  notify(control_fd);
   return 0;
 }
 
 void set_port_latency(jack_port_t *port) {
   jack_latency_range_t range;
-  range.min = range.max = tar_lat;
+  size_t measured = __atomic_load_n(&measured_latency, __ATOMIC_RELAXED);
+  range.min = range.max = measured ? measured : __atomic_load_n(&target_latency, __ATOMIC_RELAXED);
   jack_port_set_latency_range(port, JackPlaybackLatency, &range);
 }
 void latency_callback(jack_latency_callback_mode_t mode, void *arg) {
   if (mode != JackPlaybackLatency) return;
 
-  set_port_latency(jack_ports[0]);
-  if (stereo)
-    set_port_latency(jack_ports[1]);
+  for (size_t c = 0; c < channels; c++)
+    set_port_latency(jack_ports[c]);
+}
+
+
+// DIRECT MODE
+// -----------
+// The JACK thread processes each period into `dbuffer` and encodes it right
+// away into the control blocks, which it keeps `delay` samples ahead of the
+// DMA: that's one period plus a safety margin, rather than the whole control
+// block ring plus half a ringbuffer. The lead is measured after every write
+// and fed to the controller, which corrects the DMA rate (or the resampler).
+//
+// If JACK is late and the DMA overtakes the last sample written, the lead
+// comes out as almost the whole control block ring; the write position is
+// then moved back ahead of the DMA, with silence in between.
+//
+// The outputter keeps the blocks past the write position silent, but if JACK
+// stops calling back altogether (a zombified client, jackd restarting) the
+// last lead written would still be replayed every lap. So the main thread
+// watches when the JACK thread last wrote, and once it's been longer than the
+// lead lasts, silences the whole ring (see direct_watchdog). Whoever touches
+// the outputter takes `direct_owner` first.
+
+static bool direct_synced = false; // the write position has been placed (touched by the owner)
+static bool direct_muted = false;  // the watchdog silenced the ring (touched by the owner)
+static int direct_owner = 0;       // [atomic] 0 nobody, 1 the JACK thread, 2 the watchdog
+static uint64_t direct_written = 0; // [atomic] when the JACK thread last wrote (CLOCK_MONOTONIC, in ns)
+
+void direct_output(chain_t *chain, jackpifm_sample_t *const *in, size_t nframes, float *reduction) {
+  size_t count = jackpifm_pipeline_count(chain->pipeline, nframes);
+  jackpifm_pipeline_process(chain->pipeline, in, nframes, chain->dbuffer, reduction);
+
+  int idle = 0;
+  if (!__atomic_compare_exchange_n(&direct_owner, &idle, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+    // (the watchdog is silencing the ring right now)
+    jackpifm_logger_push(logger, JACKPIFM_LOG_DROPPED, nframes);
+    input_stats.dropped++;
+    return;
+  }
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  uint64_t now_ns = now.tv_sec * 1000000000ull + now.tv_nsec;
+  if (direct_muted) {
+    // (the samples missed since the last write, roughly)
+    uint64_t last = __atomic_load_n(&direct_written, __ATOMIC_RELAXED);
+    jackpifm_logger_push(logger, JACKPIFM_LOG_UNDERRUN, (now_ns - last) * chain->rate / 1000000000);
+    output_stats.underruns++;
+    direct_muted = false;
+    direct_synced = false;
+  }
+
+  size_t lead = jackpifm_outputter_lead();
+  size_t ring = jackpifm_outputter_buffer_samples();  // (as allocated, not as asked for)
+  size_t start_lead = chain->delay > count ? chain->delay - count : 0;
+  if (!direct_synced) {
+    clock_gettime(CLOCK_MONOTONIC, &output_start);
+    direct_synced = true;
+    jackpifm_outputter_seek(start_lead);
+    lead = start_lead;
+  } else if (lead > (ring + chain->delay) / 2) {
+    jackpifm_logger_push(logger, JACKPIFM_LOG_UNDERRUN, ring - lead);
+    output_stats.underruns++;
+    jackpifm_outputter_seek(start_lead);
+    lead = start_lead;
+  }
+
+  jackpifm_outputter_mark(0, cycle_start_time(chain));
+  size_t written = jackpifm_outputter_write(chain->dbuffer, count);
+  if (written < count) {
+    jackpifm_logger_push(logger, JACKPIFM_LOG_DROPPED, nframes);
+    input_stats.dropped++;
+  }
+  lead += written;
+  record_latencies(chain);
+
+  __atomic_store_n(&direct_written, now_ns, __ATOMIC_RELAXED);
+  __atomic_store_n(&direct_owner, 0, __ATOMIC_RELEASE);
+
+  // The correction applies from the next period on
+  double coefficient = jackpifm_controller_process(chain->controller, lead);
+  if (sync_resamp)
+    jackpifm_pipeline_set_factor(chain->pipeline, coefficient);
+  else
+    jackpifm_outputter_setup(chain->rate / coefficient, operiod);
+
+  output_stats.periods++;
+  if (telemetry) {
+    output_stats.ring_fill = 0;
+    output_stats.dma_queued = lead;
+    output_stats.coefficient = coefficient;
+    output_stats.integral = jackpifm_controller_integral(chain->controller);
+    update_faults();
+    jackpifm_telemetry_publish_output(telemetry, &output_stats);
+  }
+}
+
+// (main thread) Silence the ring if the JACK thread hasn't written for longer
+// than the lead lasts. Returns how long to wait before checking again, in ms.
+int direct_watchdog() {
+  size_t lead_ns = latest_chain->delay * 1e9 / latest_chain->rate;
+  int interval = lead_ns / 2000000 + 1;
+  uint64_t last = __atomic_load_n(&direct_written, __ATOMIC_RELAXED);
+  if (!last) return interval;  // (not started yet)
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (now.tv_sec * 1000000000ull + now.tv_nsec - last < lead_ns) return interval;
+
+  int idle = 0;
+  if (!__atomic_compare_exchange_n(&direct_owner, &idle, 2, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    return interval;
+  if (!direct_muted) {
+    jackpifm_outputter_mute();
+    direct_muted = true;
+    fprintf(stderr, "Warning: JACK stopped calling back, emitting silence.\n");
+  }
+  __atomic_store_n(&direct_owner, 0, __ATOMIC_RELEASE);
+  return interval;
 }
 
 
 // OUTPUT THREAD LOGIC
 // -------------------
 
+// Emit a period of silence (at the chain's nominal rate)
+static void output_silence(const chain_t *chain) {
+  memset(obuffer, 0, operiod * sizeof(jackpifm_sample_t));
+  jackpifm_outputter_setup(chain->rate, operiod);
+  jackpifm_outputter_output(obuffer, operiod);
+}
+
 void *output_thread(void *arg) {
+  chain_t *chain = __atomic_load_n(&output_chain, __ATOMIC_RELAXED);
+  bool priming = false; // waiting for a new chain to reach its delay
+
+  // Wait until there's enough delay (or we're being stopped)
+  uint64_t value;
+  ssize_t ret = read(wakeup_fd, &value, sizeof(value));
+  assert(ret == sizeof(value));
+  if (!__atomic_load_n(&thread_running, __ATOMIC_ACQUIRE))
+    return NULL;
+
   // Sync FM
   jackpifm_outputter_sync();
-
-  while (1) {
-    pthread_mutex_lock(&mutex);
-    if (!thread_running) {
-      pthread_mutex_unlock(&mutex);
-      break;
+  clock_gettime(CLOCK_MONOTONIC, &output_start);
+
+  while (__atomic_load_n(&thread_running, __ATOMIC_ACQUIRE)) {
+    // (check for a newer chain first, so that the fill read after it is final)
+    chain_t *next = __atomic_load_n(&chain->next, __ATOMIC_ACQUIRE);
+    size_t current_delay = jackpifm_ring_fill(chain->ringbuffer);
+
+    if (next && current_delay < operiod) {
+      // JACK moved to a new chain and this one is drained: emit the rest, then switch
+      mark_tags(chain, current_delay);
+      jackpifm_ring_read(chain->ringbuffer, obuffer, current_delay);
+      memset(obuffer + current_delay, 0, (operiod - current_delay) * sizeof(jackpifm_sample_t));
+      jackpifm_outputter_output(obuffer, operiod);
+      record_latencies(chain);
+
+      chain = next;
+      __atomic_store_n(&output_chain, chain, __ATOMIC_RELEASE);
+      notify(control_fd);
+      priming = true;
+      continue;
     }
 
-    size_t current_delay = (ringsize + ipos - opos) % ringsize;
-    if (current_delay >= operiod) {
-      // Read from the ringbuffer
-      if (opos + operiod > ringsize) {
-        size_t delta = ringsize - opos;
-        memcpy(obuffer, ringbuffer + opos, delta * sizeof(jackpifm_sample_t));
-        memcpy(obuffer + delta, ringbuffer, (operiod - delta) * sizeof(jackpifm_sample_t));
-      } else memcpy(obuffer, ringbuffer + opos, operiod * sizeof(jackpifm_sample_t));
-
-      opos = (opos + operiod) % ringsize;
-    } else {
-      fprintf(stderr, "The buffer got empty, delaying! :(\n");
+    if (priming) {
+      // Keep the carrier going until the new chain has enough delay
+      if (current_delay < chain->delay) {
+        output_silence(chain);
+        continue;
+      }
+      priming = false;
     }
 
-    pthread_mutex_unlock(&mutex);
+    // Emit straight from the ringbuffer, releasing the samples once they're encoded
+    // (on underrun, copy what's there followed by silence)
+    const jackpifm_sample_t *data = jackpifm_ring_read_begin(chain->ringbuffer, operiod);
+    if (!data) {
+      data = obuffer;
+      jackpifm_ring_read(chain->ringbuffer, obuffer, current_delay);
+      memset(obuffer + current_delay, 0, (operiod - current_delay) * sizeof(jackpifm_sample_t));
+
+      // (not an underrun if JACK was reconfigured and we're waiting for the new chain)
+      if (!stale_chain(chain)) {
+        jackpifm_logger_push(logger, JACKPIFM_LOG_UNDERRUN, operiod - current_delay);
+        output_stats.underruns++;
+      }
+    }
 
-    double coefficient = jackpifm_controller_process(controller, current_delay);
-    jackpifm_outputter_setup(rate / coefficient, operiod);
-    jackpifm_outputter_output(obuffer, operiod);
+    // Either slow down the DMA, or make the resampler produce more samples
+    double coefficient = jackpifm_controller_process(chain->controller, current_delay);
+    if (sync_resamp) {
+      uint64_t bits;
+      memcpy(&bits, &coefficient, sizeof(bits));
+      __atomic_store_n(&chain->factor, bits, __ATOMIC_RELAXED);
+    } else jackpifm_outputter_setup(chain->rate / coefficient, operiod);
+    mark_tags(chain, data != obuffer ? operiod : current_delay);
+    jackpifm_outputter_output(data, operiod);
+    if (data != obuffer) jackpifm_ring_read_commit(chain->ringbuffer, operiod);
+    record_latencies(chain);
+
+    output_stats.periods++;
+    if (telemetry) {
+      output_stats.ring_fill = current_delay;
+      output_stats.dma_queued = jackpifm_outputter_queued();
+      output_stats.coefficient = coefficient;
+      output_stats.integral = jackpifm_controller_integral(chain->controller);
+      update_faults();
+      jackpifm_telemetry_publish_output(telemetry, &output_stats);
+    }
   }
 
   return NULL;
@@ -279,8 +613,6 @@ void *output_thread(void *arg) {
 // [DE-]INITIALIZATION LOGIC
 // -------------------------
 
-#include "options.c"
-
 void stop_client();
 void signal_handler(int);
 
@@ -317,77 +649,215 @@ void connect_jack_port(jack_client_t *client, jack_port_t *port, const char *nam
   }
 }
 
-void start_client(const client_options *opt) {
-  // Initialize JACK client
-  jack_options_t options = JackNullOption;
-  jack_status_t status;
-  int ret;
-  if (opt->force_name) options |= JackUseExactName;
-  if (opt->server_name) options |= JackServerName;
-  jack_client = jack_client_open(opt->name, options, &status, opt->server_name);
-  assert(jack_client);
-  printf("Info: registered as '%s'\n", jack_get_client_name(jack_client));
+// Create the filters, ringbuffer and controller for a JACK setup
+chain_t *new_chain(size_t jperiod, size_t jrate) {
+  const client_options *opt = options;
+  chain_t *chain = jackpifm_calloc(1, sizeof(chain_t));
+  chain->jperiod = jperiod;
+  chain->jrate = jrate;
+  chain->rate = opt->resample ? 152000 : jrate;
+  size_t rate = chain->rate;
+
+  double max_factor = opt->sync_resamp ? opt->ctl_max_factor : 1;
+  if (direct) {
+    // Keep a period plus the margin ahead of the DMA
+    size_t iperiod = ceil(jperiod * rate / (double)jrate * max_factor) + 2;
+    chain->dbuffer = jackpifm_calloc(iperiod, sizeof(jackpifm_sample_t));
+    chain->delay = ceil(jperiod * rate / (double)jrate) + opt->direct_margin;
+    if (chain->delay > opt->dma_samples / 2) {
+      chain->delay = opt->dma_samples / 2;
+      fprintf(stderr, "The period is too large for direct mode, some samples will be dropped.\n");
+    }
+  } else {
+    // Create ringbuffer
+    size_t ringsize = opt->ringsize;
+    if (ringsize < 2*jperiod*rate/jrate) {
+      ringsize = 2*jperiod*rate/jrate;
+      fprintf(stderr, "Ringbuffer has to be at least 2x the real period size, using %zu frames.\n", ringsize);
+    }
+    chain->ringbuffer = jackpifm_ring_new(ringsize);
+    chain->ringsize = jackpifm_ring_size(chain->ringbuffer);
+    chain->delay = chain->ringsize / 2;
+    printf("Info: created ringbuffer of %zu frames.\n", chain->ringsize);
+  }
 
-  // Set parameters
-  jperiod = jack_get_buffer_size(jack_client);
-  operiod = opt->period_size;
+  // Create filters
+  jackpifm_pipeline_config_t config = {
+    channels, jrate, rate,
+    opt->preemp, opt->preemp_tau, opt->preemp_mpx,
+    opt->resamp_quality, opt->resamp_squality,
+    rds_data, rds_size,
+    opt->pilot_level, opt->rds_level,
+    max_factor,
+    opt->limiter_lookahead, opt->limiter_release, opt->clipper,
+  };
+  chain->pipeline = jackpifm_pipeline_new(&config);
+  double one = 1;
+  memcpy(&chain->factor, &one, sizeof(one));
 
-  jrate = jack_get_sample_rate(jack_client);
-  rate = opt->resample ? 152000 : jrate;
+  // Create controller
+  chain->controller = jackpifm_controller_new(1, chain->delay, opt->ctl_smooth, opt->ctl_catch, opt->ctl_catch2,
+                                              opt->ctl_pclamp, opt->ctl_quant, opt->ctl_max_factor, opt->ctl_min_factor);
 
-  if (opt->ringsize < 2*jperiod*rate/jrate) {
-    fprintf(stderr, "Ringbuffer has to be at least 2x the real period size (%d).\n", jperiod*rate/jrate);
-    abort();
+  // Calculate latency
+  if (direct) {
+    // Minimum latency is (margin), target is (lead), maximum is (GPIO latency)
+    chain->min_lat = opt->direct_margin;
+    chain->tar_lat = chain->delay;
+    chain->max_lat = opt->dma_samples;
+  } else {
+    // Minimum latency is (GPIO latency)
+    chain->min_lat = opt->dma_samples;
+    // Target latency is (GPIO latency + delay)
+    chain->tar_lat = opt->dma_samples + chain->delay;
+    // Maximum latency is (GPIO latency + ringsize)
+    chain->max_lat = opt->dma_samples + chain->ringsize;
   }
 
-  delay = opt->ringsize / 2;
+  // Convert min, tar and max into JACK time samples
+  chain->min_lat = roundf(chain->min_lat * jrate / (float)rate);
+  chain->tar_lat = roundf(chain->tar_lat * jrate / (float)rate);
+  chain->max_lat = roundf(chain->max_lat * jrate / (float)rate);
+
+  // Plus the limiters' look-ahead
+  chain->filter_delay = jackpifm_pipeline_delay(chain->pipeline);
+  chain->min_lat += chain->filter_delay;
+  chain->tar_lat += chain->filter_delay;
+  chain->max_lat += chain->filter_delay;
+
+  printf("Info: minimum latency is %zu frames (%.2fms)\n", chain->min_lat, chain->min_lat*1000 / (double)jrate);
+  printf("Info: target latency is %zu frames (%.2fms)\n", chain->tar_lat, chain->tar_lat*1000 / (double)jrate);
+  printf("Info: maximum latency is %zu frames (%.2fms)\n", chain->max_lat, chain->max_lat*1000 / (double)jrate);
+
+  __atomic_store_n(&target_latency, chain->tar_lat, __ATOMIC_RELAXED);
+  __atomic_store_n(&measured_latency, 0, __ATOMIC_RELAXED);  // (until the new chain is measured)
+  reported_latency = 0;
+  if (telemetry) {
+    telemetry->rate = rate;
+    telemetry->ringsize = chain->ringsize;
+    telemetry->delay = chain->delay;
+  }
+  return chain;
+}
 
-  // Setup resampler
-  int channels = opt->stereo ? 2 : 1;
-  if (opt->resample) {
-    double ratio = jrate / (float)rate;
-    size_t iperiod = (int)(1.02 * jperiod / ratio);
-    for (int i = 0; i < channels; i++) {
-      resampler[i] = jackpifm_resamp_new(jrate / (float)rate, opt->resamp_quality, opt->resamp_squality);
-      resampler_buffer[i] = jackpifm_calloc(channels * iperiod, sizeof(jackpifm_sample_t));
-    }
-  } else resampler[0] = NULL;
+void free_chain(chain_t *chain) {
+  jackpifm_ring_free(chain->ringbuffer);
+  free(chain->dbuffer);
+  jackpifm_pipeline_free(chain->pipeline);
+  jackpifm_controller_free(chain->controller);
+  free(chain);
+}
 
-  // Create ringbuffer
-  ringsize = opt->ringsize;
-  ringbuffer = jackpifm_calloc(ringsize, sizeof(jackpifm_sample_t));
-  obuffer = jackpifm_calloc(operiod, sizeof(jackpifm_sample_t));
-  ipos = opos = 0;
-  printf("Info: created ringbuffer of %d frames.\n", ringsize);
+// REAL-TIME HARDENING
+// -------------------
+// With --rt, everything the real-time threads touch is locked in RAM before
+// JACK is activated: mlockall() locks and faults in every current mapping (the
+// ringbuffer, obuffer, the filters' buffers, the control block pages) and every
+// later one (the threads' stacks, the chains built on reconfiguration). The
+// output thread gets SCHED_FIFO and, optionally, a CPU of its own; in direct
+// mode emission runs in JACK's thread, which JACK schedules itself.
+
+#define RT_STACK_SIZE (256 * 1024)  // output thread stack, all of it locked
+#define FAULTS_INTERVAL 64          // periods between fault count updates
+
+static void count_faults(uint64_t *major, uint64_t *minor) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  *major = usage.ru_majflt;
+  *minor = usage.ru_minflt;
+}
 
-  // Prepare thread / mutex
-  pthread_mutex_init(&mutex, NULL);
-  thread_started = false;
-  thread_running = true;
+// Refresh the fault counts in output_stats (every FAULTS_INTERVAL periods)
+static void update_faults() {
+  if (output_stats.periods % FAULTS_INTERVAL != 1) return;
+  count_faults(&output_stats.major_faults, &output_stats.minor_faults);
+  output_stats.major_faults -= major_faults_base;
+  output_stats.minor_faults -= minor_faults_base;
+}
 
-  // Create filters
-  if (opt->preemp) {
-    preemp = jackpifm_calloc(channels, sizeof(jackpifm_preemp_t *));
-    for (int c = 0; c < channels; c++)
-      preemp[c] = jackpifm_preemp_new(jrate);
-  } else preemp = NULL;
+static void lock_memory() {
+  if (mlockall(MCL_CURRENT | MCL_FUTURE)) {
+    fprintf(stderr, "Couldn't lock memory: %s\n", strerror(errno));
+    return;
+  }
+  printf("Info: all memory locked.\n");
+}
 
-  stereo = opt->stereo ? jackpifm_stereo_new() : NULL;
+static void start_output_thread(const client_options *opt) {
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  if (opt->rt) {
+    struct sched_param param = { .sched_priority = opt->rt_priority };
+    pthread_attr_setstacksize(&attr, RT_STACK_SIZE);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    pthread_attr_setschedparam(&attr, &param);
+    if (opt->rt_cpu >= 0) {
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      CPU_SET(opt->rt_cpu, &cpus);
+      pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    }
+  }
+
+  int ret = pthread_create(&thread, &attr, output_thread, NULL);
+  if (ret && opt->rt) {
+    // Not allowed (no CAP_SYS_NICE or RLIMIT_RTPRIO), or no such CPU
+    fprintf(stderr, "Couldn't start the output thread as real-time: %s\n", strerror(ret));
+    ret = pthread_create(&thread, NULL, output_thread, NULL);
+  } else if (opt->rt) {
+    if (opt->rt_cpu >= 0)
+      printf("Info: output thread running with SCHED_FIFO priority %ld on CPU %ld.\n", opt->rt_priority, opt->rt_cpu);
+    else
+      printf("Info: output thread running with SCHED_FIFO priority %ld.\n", opt->rt_priority);
+  }
+  assert(!ret);
+  pthread_attr_destroy(&attr);
+}
+
+void start_client(const client_options *opt) {
+  // Initialize JACK client
+  jack_options_t jack_options = JackNullOption;
+  jack_status_t status;
+  int ret;
+  if (opt->force_name) jack_options |= JackUseExactName;
+  if (opt->server_name) jack_options |= JackServerName;
+  jack_client = jack_client_open(opt->name, jack_options, &status, opt->server_name);
+  assert(jack_client);
+  printf("Info: registered as '%s'\n", jack_get_client_name(jack_client));
+
+  // Set parameters
+  options = opt;
+  operiod = opt->period_size;
+  channels = opt->stereo ? 2 : 1;
+  sync_resamp = opt->sync_resamp;
+  direct = opt->direct;
+  obuffer = jackpifm_calloc(operiod, sizeof(jackpifm_sample_t));
+  size_t jperiod = jack_get_buffer_size(jack_client);
+  size_t jrate = jack_get_sample_rate(jack_client);
+  jack_jperiod = jperiod;
+  jack_jrate = jrate;
 
   if (opt->rds_file) {
     uint8_t *data;
-    size_t size;
-    read_file(opt->rds_file, &data, &size);
+    read_file(opt->rds_file, &data, &rds_size);
     rds_data = data;
-    rds = jackpifm_rds_new(data, size);
-  } else {
-    rds_data = NULL;
-    rds = NULL;
+  } else rds_data = NULL;
+
+  // Publish statistics
+  telemetry_name = opt->telemetry;
+  if (telemetry_name) {
+    telemetry = jackpifm_telemetry_create(telemetry_name);
+    assert(telemetry);
+    printf("Info: publishing statistics at '%s'.\n", telemetry_name);
   }
 
+  // Create ringbuffer, filters and controller
+  jack_chain = output_chain = oldest_chain = latest_chain = new_chain(jperiod, jrate);
+
   // Create ports
   unsigned long port_flags = JackPortIsInput | JackPortIsTerminal | JackPortIsPhysical;
-  if (stereo) {
+  if (channels == 2) {
     jack_ports[0] = jack_port_register(jack_client, "left", JACK_DEFAULT_AUDIO_TYPE, port_flags, 0);
     jack_ports[1] = jack_port_register(jack_client, "right", JACK_DEFAULT_AUDIO_TYPE, port_flags, 0);
     assert(jack_ports[0] && jack_ports[1]);
@@ -396,38 +866,54 @@ void start_client(const client_options *opt) {
     assert(jack_ports[0]);
   }
 
-  // Calculate latency
-  // Minimum latency is (GPIO latency)
-  min_lat = (JACKPIFM_BUFFERSAMPLES);
-  // Target latency is (GPIO latency + delay)
-  tar_lat = (JACKPIFM_BUFFERSAMPLES) + delay;
-  // Maximum latency is (GPIO latency + ringsize)
-  max_lat = (JACKPIFM_BUFFERSAMPLES) + ringsize;
-
-  // Convert min, tar and max into JACK time samples
-  min_lat = roundf(min_lat * jrate / (float)rate);
-  tar_lat = roundf(tar_lat * jrate / (float)rate);
-  max_lat = roundf(max_lat * jrate / (float)rate);
-
-  printf("Info: minimum latency is %u frames (%.2fms)\n", min_lat, min_lat*1000 / (double)jrate);
-  printf("Info: target latency is %u frames (%.2fms)\n", tar_lat, tar_lat*1000 / (double)jrate);
-  printf("Info: maximum latency is %u frames (%.2fms)\n", max_lat, max_lat*1000 / (double)jrate);
-
   // Set JACK callbacks
+  control_fd = eventfd(0, 0);
+  assert(control_fd >= 0);
   jack_set_process_callback(jack_client, process_callback, NULL);
   jack_set_buffer_size_callback(jack_client, buffer_size_callback, NULL);
   jack_set_sample_rate_callback(jack_client, sample_rate_callback, NULL);
   jack_set_latency_callback(jack_client, latency_callback, NULL);
 
   // Setup FM and subscribe to exit
-  ret = jackpifm_setup_fm();
-  assert(!ret);
-  jackpifm_setup_dma(opt->frequency);
-  jackpifm_outputter_setup(rate, operiod);
-  printf("Info: carrier frequency %.2f MHz, rate %u Hz, period %u frames.\n", opt->frequency, rate, operiod);
+  if (opt->sim_dma) {
+    ret = jackpifm_simdma_open(opt->sim_dma, 1);
+    assert(!ret);
+    jackpifm_outputter_set_backend(&jackpifm_sim_dma);
+    printf("Info: simulating DMA, dumping control blocks to '%s'.\n", opt->sim_dma);
+  } else {
+    ret = jackpifm_setup_fm();
+    assert(!ret);
+  }
+  jackpifm_outputter_setup(latest_chain->rate, operiod);
+  jackpifm_setup_dma(opt->frequency, opt->dma_samples);
+  verify_encoder = opt->verify_encoder;
+  jackpifm_outputter_verify(verify_encoder);
+  jackpifm_outputter_fixed(opt->fixed_point);
+  if (direct)
+    printf("Info: carrier frequency %.2f MHz, rate %zu Hz, direct mode.\n", opt->frequency, latest_chain->rate);
+  else
+    printf("Info: carrier frequency %.2f MHz, rate %zu Hz, period %zu frames.\n", opt->frequency, latest_chain->rate, operiod);
+  printf("Info: DMA ring of %zu samples (%.2fms).\n", jackpifm_outputter_buffer_samples(),
+         jackpifm_outputter_buffer_samples()*1000 / (double)latest_chain->rate);
+
+  // Everything is allocated by now
+  if (opt->rt) {
+    lock_memory();
+    if (direct && opt->rt_cpu >= 0)
+      fprintf(stderr, "There's no output thread in direct mode, --rt-cpu is ignored.\n");
+  }
 
-  // Create controller
-  controller = jackpifm_controller_new(1, delay, 256, 100000, 10000, 15.0, 10000.0, 1*2.0, 1/2.0);
+  // Start logging (at most one line per kind of event and second)
+  logger = jackpifm_logger_new(1024, 1.0);
+
+  // Start the output thread; it will wait until the ringbuffer is filled
+  if (!direct) {
+    wakeup_fd = eventfd(0, 0);
+    assert(wakeup_fd >= 0);
+    thread_started = false;
+    thread_running = true;
+    start_output_thread(opt);
+  }
 
   // Subscribe signal handlers
   atexit(stop_client);
@@ -440,59 +926,130 @@ void start_client(const client_options *opt) {
   printf("\n");
   ret = jack_activate(jack_client);
   assert(!ret);
+  count_faults(&major_faults_base, &minor_faults_base);  // (JACK's thread has been created)
 
   // Connect ports
-  connect_jack_port(jack_client, jack_ports[0], opt->target_ports[0]);
-  if (stereo)
-    connect_jack_port(jack_client, jack_ports[1], opt->target_ports[1]);
+  for (size_t c = 0; c < channels; c++)
+    connect_jack_port(jack_client, jack_ports[c], opt->target_ports[c]);
+}
+
+
+// RECONFIGURATION
+// ---------------
+// When JACK changes its buffer size or sample rate, its callbacks (which can't
+// block) wake up the main thread, which builds a new chain and hands it over:
+//
+//  1. The JACK thread picks it up on its next period, links it after the chain
+//     it was writing to, and writes to the new one from then on. Periods that
+//     arrive in the new setup before the chain is ready are dropped.
+//
+//  2. The output thread keeps emitting the old ringbuffer until it's drained,
+//     then switches and emits silence until the new one reaches its delay.
+//     The DMA never stops, it only changes its rate if needed.
+//
+//  3. The main thread frees the chains the output thread has left behind.
+
+static void free_old_chains() {
+  chain_t *current = __atomic_load_n(&output_chain, __ATOMIC_ACQUIRE);
+  while (oldest_chain != current) {
+    chain_t *next = oldest_chain->next;
+    free_chain(oldest_chain);
+    oldest_chain = next;
+  }
+}
+
+void control_loop() {
+  struct pollfd control = { .fd = control_fd, .events = POLLIN };
+  while (1) {
+    // In direct mode, nothing else notices if JACK stops calling back, and
+    // the JACK thread doesn't notify: wake up every few ms to check
+    if (direct) {
+      int ret = poll(&control, 1, direct_watchdog());
+      if (ret < 0 && errno == EINTR) continue;
+      assert(ret >= 0);
+    }
+
+    if (!direct || (control.revents & POLLIN)) {
+      uint64_t value;
+      ssize_t ret = read(control_fd, &value, sizeof(value));
+      if (ret < 0 && errno == EINTR) continue;
+      assert(ret == sizeof(value));
+    }
+    free_old_chains();
+
+    // The output thread measured a different latency
+    size_t measured = __atomic_load_n(&measured_latency, __ATOMIC_RELAXED);
+    if (measured && measured != reported_latency) {
+      reported_latency = measured;
+      jack_recompute_total_latencies(jack_client);
+    }
+
+    size_t jperiod = __atomic_load_n(&jack_jperiod, __ATOMIC_RELAXED);
+    size_t jrate = __atomic_load_n(&jack_jrate, __ATOMIC_RELAXED);
+    if (jperiod == latest_chain->jperiod && jrate == latest_chain->jrate) continue;
+
+    printf("Info: JACK changed to %zu frames at %zu Hz, rebuilding.\n", jperiod, jrate);
+    latest_chain = new_chain(jperiod, jrate);
+    chain_t *unused = __atomic_exchange_n(&next_chain, latest_chain, __ATOMIC_ACQ_REL);
+    if (unused) free_chain(unused); // superseded before the JACK thread saw it
+    jack_recompute_total_latencies(jack_client);
+  }
 }
 
 void stop_client() {
+  uint64_t major_faults, minor_faults;
+  count_faults(&major_faults, &minor_faults);
+
   // Stop processing audio
   jack_deactivate(jack_client);
 
-  // Stop the thread if running
-  pthread_mutex_lock(&mutex);
-  thread_running = false;
-  pthread_mutex_unlock(&mutex);
+  // Stop the thread (waking it up if it's still waiting)
+  if (!direct) {
+    __atomic_store_n(&thread_running, false, __ATOMIC_RELEASE);
+    if (!__atomic_exchange_n(&thread_started, true, __ATOMIC_RELAXED))
+      notify(wakeup_fd);
 
-  if (thread_started) {
     void *ret;
     pthread_join(thread, &ret);
+    close(wakeup_fd);
   }
 
   // Disconnect from JACK
   jack_client_close(jack_client);
+  jackpifm_logger_free(logger);
+  close(control_fd);
 
   // Free everything
-  int channels = stereo ? 2 : 1;
-  if (resampler[0]) {
-    for (int i = 0; i < channels; i++) {
-      free(resampler_buffer[i]);
-      jackpifm_resamp_free(resampler[i]);
-    }
+  while (oldest_chain) {
+    chain_t *next = oldest_chain->next;
+    free_chain(oldest_chain);
+    oldest_chain = next;
   }
-
-  free(ringbuffer);
+  if (next_chain) free_chain(next_chain);
   free(obuffer);
-
-  if (preemp) {
-    for (int c = 0; c < channels; c++)
-      jackpifm_preemp_free(preemp[c]);
-    free(preemp);
-  }
-
-  jackpifm_stereo_free(stereo);
-  jackpifm_rds_free(rds);
   free((uint8_t *)rds_data);
+  jackpifm_telemetry_close(telemetry, telemetry_name);
+
+  // Report how often the output thread polled the DMA and woke up
+  if (output_start.tv_sec) {
+    struct timespec now;
+    uint64_t reads, wakeups;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    jackpifm_outputter_stats(&reads, &wakeups);
+    double elapsed = (now.tv_sec - output_start.tv_sec) + (now.tv_nsec - output_start.tv_nsec) / 1e9;
+    if (elapsed > 0)
+      printf("Info: %.0f DMA position reads/s, %.0f wakeups/s.\n", reads / elapsed, wakeups / elapsed);
+  }
+  print_latencies();
+  printf("Info: %llu major and %llu minor page faults while running.\n",
+         (unsigned long long)(major_faults - major_faults_base), (unsigned long long)(minor_faults - minor_faults_base));
 
-  jackpifm_controller_free(controller);
+  if (verify_encoder)
+    printf("Info: %zu samples differed from the reference encoder.\n", jackpifm_outputter_mismatches());
 
   // Unsetup FM
   jackpifm_unsetup_dma();
-
-  // Finally, destroy the mutex
-  pthread_mutex_destroy(&mutex);
+  jackpifm_simdma_close();
 
   printf("\nAll done.\n");
 }
@@ -501,11 +1058,182 @@ void signal_handler(int sig) {
   exit(0);
 }
 
+
+// OFFLINE RENDER MODE
+// -------------------
+
+#define RENDER_PERIOD 1024
+
+typedef enum { RENDER_FLOAT, RENDER_PCM16 } render_format_t;
+
+static FILE *render_output; // NULL when feeding the outputter
+
+static uint32_t read_le(const uint8_t *data, size_t size) {
+  uint32_t value = 0;
+  for (size_t i = size; i > 0; i--)
+    value = (value << 8) | data[i-1];
+  return value;
+}
+
+// If `file` is a WAV file, parse its header and leave it at the start of the samples.
+// Otherwise rewind it and leave the parameters untouched.
+static void read_wav_header(FILE *file, const char *name, size_t *file_channels, size_t *file_rate, render_format_t *format) {
+  uint8_t header[12], chunk[8], fmt[16];
+  if (fread(header, 1, 12, file) != 12 || memcmp(header, "RIFF", 4) || memcmp(header + 8, "WAVE", 4)) {
+    rewind(file);
+    return;
+  }
+
+  bool have_fmt = false;
+  while (fread(chunk, 1, 8, file) == 8) {
+    uint32_t size = read_le(chunk + 4, 4);
+
+    if (!memcmp(chunk, "fmt ", 4) && size >= 16) {
+      if (fread(fmt, 1, 16, file) != 16) break;
+      fseek(file, size - 16 + (size & 1), SEEK_CUR);
+      uint16_t tag = read_le(fmt, 2), bits = read_le(fmt + 14, 2);
+      *file_channels = read_le(fmt + 2, 2);
+      *file_rate = read_le(fmt + 4, 4);
+      if (tag == 1 && bits == 16) *format = RENDER_PCM16;
+      else if (tag == 3 && bits == 32) *format = RENDER_FLOAT;
+      else {
+        fprintf(stderr, "'%s': only 16-bit PCM and 32-bit float WAV files are supported.\n", name);
+        exit(1);
+      }
+      have_fmt = true;
+    } else if (!memcmp(chunk, "data", 4) && have_fmt) {
+      return;
+    } else fseek(file, size + (size & 1), SEEK_CUR);
+  }
+
+  fprintf(stderr, "'%s': malformed WAV file.\n", name);
+  exit(1);
+}
+
+void render(const client_options *opt) {
+  FILE *input = fopen(opt->render_file, "rb");
+  if (!input) {
+    fprintf(stderr, "Couldn't open '%s': %s\n", opt->render_file, strerror(errno));
+    exit(1);
+  }
+
+  // Input format (raw files are interleaved native floats)
+  channels = opt->stereo ? 2 : 1;
+  size_t file_channels = channels;
+  size_t file_rate = opt->render_rate;
+  render_format_t format = RENDER_FLOAT;
+  read_wav_header(input, opt->render_file, &file_channels, &file_rate, &format);
+  if (file_channels != channels) {
+    fprintf(stderr, "'%s' has %zu channels, expected %zu.\n", opt->render_file, file_channels, channels);
+    exit(1);
+  }
+
+  operiod = opt->period_size;
+  size_t jrate = file_rate;
+  size_t rate = opt->resample ? 152000 : jrate;
+
+  // Create filters
+  jackpifm_pipeline_config_t config = {
+    channels, jrate, rate,
+    opt->preemp, opt->preemp_tau, opt->preemp_mpx,
+    opt->resamp_quality, opt->resamp_squality,
+    NULL, 0,
+    opt->pilot_level, opt->rds_level, 1,
+    opt->limiter_lookahead, opt->limiter_release, opt->clipper,
+  };
+  if (opt->rds_file) {
+    uint8_t *data;
+    read_file(opt->rds_file, &data, &config.rds_size);
+    config.rds_data = rds_data = data;
+  }
+  jackpifm_pipeline_t *pipeline = jackpifm_pipeline_new(&config);
+
+  // Open output
+  if (opt->output_cb) {
+    int ret = jackpifm_simdma_open(opt->output_file, 0);
+    if (ret) exit(1);
+    jackpifm_outputter_set_backend(&jackpifm_sim_dma);
+    jackpifm_outputter_setup(rate, operiod);
+    jackpifm_setup_dma(opt->frequency, opt->dma_samples);
+    jackpifm_outputter_verify(opt->verify_encoder);
+    jackpifm_outputter_fixed(opt->fixed_point);
+    jackpifm_outputter_sync();
+    render_output = NULL;
+  } else {
+    render_output = fopen(opt->output_file, "wb");
+    if (!render_output) {
+      fprintf(stderr, "Couldn't open '%s': %s\n", opt->output_file, strerror(errno));
+      exit(1);
+    }
+  }
+  printf("Info: rendering '%s' (%zu Hz) to '%s' (%zu Hz, %s).\n", opt->render_file, jrate,
+         opt->output_file, rate, opt->output_cb ? "control blocks" : "MPX");
+
+  // Process everything
+  size_t sample_size = (format == RENDER_PCM16) ? 2 : 4;
+  uint8_t *raw = jackpifm_malloc(RENDER_PERIOD * channels * sample_size);
+  jackpifm_sample_t *in[2];
+  for (size_t c = 0; c < channels; c++)
+    in[c] = jackpifm_malloc(RENDER_PERIOD * sizeof(jackpifm_sample_t));
+  jackpifm_sample_t *out = jackpifm_malloc((RENDER_PERIOD * rate / jrate + 2) * sizeof(jackpifm_sample_t));
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  size_t frames, total_in = 0, total_out = 0;
+  float reduction = 0;
+  while ((frames = fread(raw, channels * sample_size, RENDER_PERIOD, input)) > 0) {
+    for (size_t i = 0; i < frames; i++)
+      for (size_t c = 0; c < channels; c++) {
+        const uint8_t *sample = raw + (i * channels + c) * sample_size;
+        if (format == RENDER_PCM16) in[c][i] = (int16_t)read_le(sample, 2) / 32768.0f;
+        else memcpy(&in[c][i], sample, sizeof(float));
+      }
+
+    // Write the MPX signal or feed the outputter
+    size_t count = jackpifm_pipeline_process(pipeline, in, frames, out, &reduction);
+    if (render_output) {
+      size_t written = fwrite(out, sizeof(jackpifm_sample_t), count, render_output);
+      assert(written == count);
+    } else jackpifm_outputter_output(out, count);
+    total_out += count;
+    total_in += frames;
+  }
+
+  // Let the DMA execute what's left, and record exactly what we wrote
+  if (opt->output_cb) {
+    jackpifm_simdma_limit(total_out * 4);
+    jackpifm_outputter_drain();
+    jackpifm_unsetup_dma();
+    jackpifm_simdma_close();
+    if (opt->verify_encoder)
+      printf("Info: %zu samples differed from the reference encoder.\n", jackpifm_outputter_mismatches());
+  } else fclose(render_output);
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  double duration = total_in / (double)jrate;
+  printf("Info: rendered %zu frames into %zu samples, limiter reduced the gain by up to %.1fdB.\n", total_in, total_out, reduction);
+  printf("Info: %.2fs of audio in %.2fs (%.1fx realtime).\n", duration, elapsed, duration / elapsed);
+
+  fclose(input);
+  free(raw);
+  for (size_t c = 0; c < channels; c++)
+    free(in[c]);
+  free(out);
+  jackpifm_pipeline_free(pipeline);
+  free((uint8_t *)rds_data);
+}
+
 int main(int argc, char **argv) {
   client_options options;
   parse_jackpifm_options(&options, argc, argv);
 
-  start_client(&options);
+  if (options.render_file) {
+    render(&options);
+    return 0;
+  }
 
-  while (1) sleep(600);
+  start_client(&options);
+  control_loop();
 }
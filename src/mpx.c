@@ -0,0 +1,87 @@
+#include "mpx.h"
+
+#include <math.h>
+
+#include "rds.h"
+
+#define PI 3.14159265358979323846
+
+/* The phase counter runs over one RDS bit, which spans a whole number of pilot
+ * periods; the pilot, 38kHz and 57kHz carriers are tabulated over it (already
+ * scaled by their levels) so composing is a single pass of multiply-adds. */
+#define CYCLE JACKPIFM_RDS_BIT_SAMPLES
+
+struct jackpifm_mpx_t {
+  bool stereo;
+  float audio_level;
+  size_t phase;
+
+  jackpifm_rds_t *rds;
+  const jackpifm_sample_t *symbol;  /* RDS bit being sent, or silence */
+
+  jackpifm_sample_t pilot[CYCLE];
+  jackpifm_sample_t subcarrier[CYCLE];
+  jackpifm_sample_t rds_carrier[CYCLE];
+  jackpifm_sample_t silence[CYCLE];
+};
+
+jackpifm_mpx_t *jackpifm_mpx_new(const jackpifm_mpx_config_t *config) {
+  jackpifm_mpx_t *mpx = jackpifm_calloc(1, sizeof(jackpifm_mpx_t));
+  mpx->stereo = config->stereo;
+  mpx->audio_level = config->audio_level;
+  mpx->phase = 0;
+
+  /* 152kHz / 8 = 19kHz */
+  for (size_t i = 0; i < CYCLE; i++) {
+    double phase = (i % 8) * 2*PI/8;
+    mpx->pilot[i] = config->pilot_level * sin(phase);
+    mpx->subcarrier[i] = config->audio_level * sin(2 * phase);
+    mpx->rds_carrier[i] = config->rds_level * sin(3 * phase);
+  }
+
+  if (config->rds_data)
+    mpx->rds = jackpifm_rds_new(config->rds_data, config->rds_size);
+  mpx->symbol = mpx->silence;
+  return mpx;
+}
+
+void jackpifm_mpx_process(jackpifm_mpx_t *mpx, jackpifm_sample_t *data, const jackpifm_sample_t *left, const jackpifm_sample_t *right, size_t size) {
+  size_t phase = mpx->phase;
+  float level = mpx->audio_level;
+
+  while (size) {
+    if (phase == 0 && mpx->rds)
+      mpx->symbol = jackpifm_rds_symbol(mpx->rds);
+
+    size_t n = CYCLE - phase;
+    if (n > size) n = size;
+    const jackpifm_sample_t *pilot = mpx->pilot + phase;
+    const jackpifm_sample_t *subcarrier = mpx->subcarrier + phase;
+    const jackpifm_sample_t *rds_carrier = mpx->rds_carrier + phase;
+    const jackpifm_sample_t *symbol = mpx->symbol + phase;
+
+    if (mpx->stereo) {
+      for (size_t i = 0; i < n; i++) {
+        jackpifm_sample_t l = left[i], r = right[i];
+        data[i] = level * (l + r) + (l - r) * subcarrier[i] + pilot[i] + symbol[i] * rds_carrier[i];
+      }
+      right += n;
+    } else {
+      for (size_t i = 0; i < n; i++)
+        data[i] = level * left[i] + symbol[i] * rds_carrier[i];
+    }
+
+    data += n;
+    left += n;
+    size -= n;
+    phase = (phase + n) % CYCLE;
+  }
+
+  mpx->phase = phase;
+}
+
+void jackpifm_mpx_free(jackpifm_mpx_t *mpx) {
+  if (!mpx) return;
+  jackpifm_rds_free(mpx->rds);
+  free(mpx);
+}
@@ -0,0 +1,39 @@
+/* mpx.h - composes the 152kHz multiplex signal: audio, stereo pilot and subcarrier, and RDS */
+
+#ifndef JACKPIFM_MPX_H
+#define JACKPIFM_MPX_H
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct jackpifm_mpx_t jackpifm_mpx_t;
+
+typedef struct {
+  bool stereo;              /* add the pilot and the L-R subcarrier */
+  float audio_level;        /* gain for L+R (and L-R) */
+  float pilot_level;        /* 19kHz pilot amplitude */
+  float rds_level;          /* 57kHz RDS subcarrier amplitude */
+  const uint8_t *rds_data;  /* RDS blob to encode, or NULL */
+  size_t rds_size;
+} jackpifm_mpx_config_t;
+
+/* jackpifm_mpx_new: create new MPX compositor. All carriers are generated from
+ *                   a single phase counter, so they stay locked to the pilot. */
+jackpifm_mpx_t *jackpifm_mpx_new(const jackpifm_mpx_config_t *config) __attribute__((malloc));
+
+/* jackpifm_mpx_process: compose `size` samples at 152kHz into data, from left and
+ *                       right (ignored if not stereo). `data` may be the same buffer
+ *                       as `left`, but mustn't overlap otherwise. */
+void jackpifm_mpx_process(jackpifm_mpx_t *mpx, jackpifm_sample_t *data, const jackpifm_sample_t *left, const jackpifm_sample_t *right, size_t size);
+
+/* jackpifm_mpx_free: deallocate an MPX compositor */
+void jackpifm_mpx_free(jackpifm_mpx_t *mpx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JACKPIFM_MPX_H */
@@ -91,7 +91,15 @@ typedef struct {
   float frequency;
   bool stereo;
   const char *rds_file;
+  float pilot_level;
+  float rds_level;
   bool preemp;
+  double preemp_tau;
+  bool preemp_mpx;
+  double limiter_lookahead;
+  double limiter_release;
+  bool clipper;
+  const char *sim_dma;
 
   // Resampling
   bool resample;
@@ -99,12 +107,39 @@ typedef struct {
   size_t ringsize;
   size_t resamp_quality;
   size_t resamp_squality;
+  bool sync_resamp;
+  bool direct;
+  size_t direct_margin;
+  size_t dma_samples;
+
+  // Controller
+  size_t ctl_smooth;
+  long ctl_catch;
+  long ctl_catch2;
+  double ctl_pclamp;
+  double ctl_quant;
+  double ctl_max_factor;
+  double ctl_min_factor;
 
   // JACK
   const char *name;
   const char *server_name;
   bool force_name;
   const char *target_ports[2];
+
+  // Offline rendering
+  const char *render_file;
+  const char *output_file;
+  bool output_cb;
+  size_t render_rate;
+
+  // Other
+  bool rt;
+  long rt_priority;
+  long rt_cpu;
+  bool fixed_point;
+  bool verify_encoder;
+  const char *telemetry;
 } client_options;
 
 static const client_options default_values = {
@@ -115,7 +150,15 @@ static const client_options default_values = {
   103.3, // frequency
   false, // stereo
   NULL,  // RDS blob file
+  0.1,   // pilot level
+  0.05,  // RDS level
   true,  // preemp
+  75e-6, // preemp time constant (s)
+  false, // preemp at the MPX rate
+  0.001, // limiter look-ahead (s)
+  0.05,  // limiter release (s)
+  false, // composite clipper
+  NULL,  // simulated DMA dump file
 
   // Resampling
   false, // resamp
@@ -123,12 +166,43 @@ static const client_options default_values = {
   16384, // ringsize
   5,     // resamp quality
   10,    // resamp squality
+  false, // absorb drift by resampling, instead of changing the DMA rate
+  false, // direct mode
+  512,   // direct mode margin
+  JACKPIFM_BUFFERSAMPLES, // DMA ring size
+
+  // Controller
+  256,    // smoothing window
+  100000, // catch factor
+  10000,  // catch factor 2
+  15.0,   // P clamp
+  0,      // quantization (depends on the sync mode)
+  2.0,    // max resample factor
+  0.5,    // min resample factor
 
   // JACK
   "jackpifm", // client name
   NULL,  // server name
   false, // force name
   {NULL, NULL}, // target ports
+
+  // Offline rendering
+  NULL,  // render input file
+  NULL,  // render output file
+  false, // output control blocks
+  48000, // raw input rate
+
+  // Other
+  false, // real-time hardening
+  50,    // output thread priority
+  -1,    // output thread CPU (any)
+#ifdef JACKPIFM_FIXED_POINT
+  true,  // fixed-point encoder
+#else
+  false, // fixed-point encoder
+#endif
+  false, // verify encoder
+  NULL,  // telemetry segment
 };
 
 static void print_help(const char *basename) {
@@ -140,6 +214,7 @@ static void print_help(const char *basename) {
   printf("Usage:\n"
          "  %1$s [options] [PORT]\n"
          "  %1$s [options] [L_PORT R_PORT]\n"
+         "  %1$s [options] --render=INPUT --output=OUTPUT\n"
          "  %1$s (--help | --version)\n",
          basename);
   printf("\n");
@@ -149,16 +224,39 @@ static void print_help(const char *basename) {
   print_option('f', "frequency=FREQ", "Set the FM carrier frequency in MHz. [default: 103.3]");
   print_option('s', "stereo", "Enable stereo emission.");
   print_option('R', "rds=FILE", "Encode an RDS blob with the stream.");
+  print_option(  0, "pilot-level=L", "Amplitude of the stereo pilot, relative to full deviation. [default: 0.1]");
+  print_option(  0, "rds-level=L", "Amplitude of the RDS subcarrier, relative to full deviation. [default: 0.05]");
   print_option('e', "no-preemp", "Disable the pre-emphasis filter.");
+  print_option(  0, "preemp=US", "Pre-emphasis time constant in us: 50 (Europe) or 75 (Americas). [default: 75]");
+  print_option(  0, "preemp-mpx", "Pre-emphasize after resampling, at 152kHz, rather than at the JACK rate.");
+  print_option(  0, "limiter-lookahead=MS", "Look-ahead of the limiters, which delay the audio as much. [default: 1]");
+  print_option(  0, "limiter-release=MS", "Release time of the limiters. [default: 50]");
+  print_option(  0, "clipper", "Clip the composite signal (with pilot and RDS) to full deviation.");
+  print_option(  0, "sim-dma=FILE", "Don't touch the hardware; simulate the DMA and dump what it emits to FILE.");
   printf("\n");
 
   // Sampling options
   printf("Sampling options:\n");
   print_option('r', "resamp", "Resample sound to 152kHz before emission.");
   print_option('p', "period=FRAMES", "Output (emission) period in frames. [default: 512]");
-  print_option('r', "ringsize=FRAMES", "Size of the ringbuffer in frames. [default: 16384]");
+  print_option('r', "ringsize=FRAMES", "Ringbuffer size in frames, rounded up to a power of two. [default: 16384]");
   print_option(  0, "resamp-quality=N", "Resampling lookup table row size. [default: 5]");
   print_option(  0, "resamp-squality=N", "Resampling lookup table column size. [default: 10]");
+  print_option(  0, "direct", "Encode straight into the DMA from the JACK thread, for the lowest latency.");
+  print_option(  0, "direct-margin=N", "In direct mode, samples kept ahead of the DMA besides one period. [default: 512]");
+  print_option(  0, "dma-samples=N", "Size of the DMA ring in samples, rounded up to a page (32 samples). At least two periods outside direct mode. [default: 8192]");
+  print_option(  0, "sync=MODE", "Absorb clock drift by changing the DMA rate (dma) or the resampling ratio (resamp). [default: dma]");
+  printf("\n");
+
+  // Controller options
+  printf("Rate controller options:\n");
+  print_option(  0, "ctl-smooth=N", "Periods the delay is averaged over (Hann window). [default: 256]");
+  print_option(  0, "ctl-catch=N", "Inverse of the proportional gain. [default: 100000]");
+  print_option(  0, "ctl-catch2=N", "Integral time, in periods. [default: 10000]");
+  print_option(  0, "ctl-pclamp=D", "Ignore averaged offsets smaller than D samples in the P term. [default: 15]");
+  print_option(  0, "ctl-quant=Q", "Quantize the rate coefficient to steps of 1/Q. [default: 10000, 1e7 with --sync=resamp]");
+  print_option(  0, "ctl-max=F", "Maximum rate coefficient. [default: 2]");
+  print_option(  0, "ctl-min=F", "Minimum rate coefficient. [default: 0.5]");
   printf("\n");
 
   // JACK options
@@ -168,8 +266,26 @@ static void print_help(const char *basename) {
   print_option(  0, "force-name", "Force the client to use the given name.");
   printf("\n");
 
+  // Offline rendering options
+  printf("Offline rendering options:\n");
+  print_option(  0, "render=FILE", "Process a WAV (or raw float) file instead of JACK, as fast as possible.");
+  print_option(  0, "output=FILE", "Where to write the rendered 152kHz MPX signal (raw float).");
+  print_option(  0, "output-cb", "Write the control block stream the DMA executes, instead of MPX.");
+  print_option(  0, "render-rate=HZ", "Sample rate of raw input files. [default: 48000]");
+  printf("\n");
+
   // Other options
   printf("Other options:\n");
+  print_option(  0, "rt", "Lock all memory, and run the output thread with SCHED_FIFO.");
+  print_option(  0, "rt-priority=N", "SCHED_FIFO priority of the output thread, with --rt. [default: 50]");
+  print_option(  0, "rt-cpu=N", "Pin the output thread to CPU N, with --rt. [default: none]");
+#ifdef JACKPIFM_FIXED_POINT
+  print_option(  0, "encoder=TYPE", "Output encoder arithmetic, 'float' or 'fixed' (faster on ARM11). [default: fixed]");
+#else
+  print_option(  0, "encoder=TYPE", "Output encoder arithmetic, 'float' or 'fixed' (faster on ARM11). [default: float]");
+#endif
+  print_option(  0, "verify-encoder", "Check the output encoder against the reference one (slow).");
+  print_option(  0, "telemetry=NAME", "Publish live statistics in shared memory NAME (see jackpifm-stat).");
   print_option('h', "help", "Print this help message.");
   print_option('v', "version", "Print program version.");
   printf("\n");
@@ -282,11 +398,76 @@ static int parse_long_option(char *opt, char *next, void *opaque) {
     return 2;
   }
 
+  if (strcmp(opt, "pilot-level") == 0 && next) {
+    double level;
+    if (parse_float(next, &level) && level >= 0 && level < 1) {
+      data->pilot_level = level;
+      return 2;
+    }
+    fprintf(stderr, "Wrong pilot level value.\n");
+    return 0;
+  }
+
+  if (strcmp(opt, "rds-level") == 0 && next) {
+    double level;
+    if (parse_float(next, &level) && level >= 0 && level < 1) {
+      data->rds_level = level;
+      return 2;
+    }
+    fprintf(stderr, "Wrong RDS level value.\n");
+    return 0;
+  }
+
   if (strcmp(opt, "no-preemp") == 0) {
     data->preemp = false;
     return 1;
   }
 
+  if (strcmp(opt, "preemp") == 0 && next) {
+    long value;
+    if (parse_int(next, &value) && (value == 50 || value == 75)) {
+      data->preemp_tau = value * 1e-6;
+      return 2;
+    }
+    fprintf(stderr, "Wrong pre-emphasis time constant, it must be 50 or 75.\n");
+    return 0;
+  }
+
+  if (strcmp(opt, "preemp-mpx") == 0) {
+    data->preemp_mpx = true;
+    return 1;
+  }
+
+  if (strcmp(opt, "limiter-lookahead") == 0 && next) {
+    double value;
+    if (parse_float(next, &value) && value >= 0 && value <= 100) {
+      data->limiter_lookahead = value / 1000;
+      return 2;
+    }
+    fprintf(stderr, "Wrong limiter look-ahead value.\n");
+    return 0;
+  }
+
+  if (strcmp(opt, "limiter-release") == 0 && next) {
+    double value;
+    if (parse_float(next, &value) && value > 0) {
+      data->limiter_release = value / 1000;
+      return 2;
+    }
+    fprintf(stderr, "Wrong limiter release value.\n");
+    return 0;
+  }
+
+  if (strcmp(opt, "clipper") == 0) {
+    data->clipper = true;
+    return 1;
+  }
+
+  if (strcmp(opt, "sim-dma") == 0 && next) {
+    data->sim_dma = next;
+    return 2;
+  }
+
   if (strcmp(opt, "resamp") == 0) {
     data->resample = true;
     return 1;
@@ -332,6 +513,110 @@ static int parse_long_option(char *opt, char *next, void *opaque) {
     return 0;
   }
 
+  if (strcmp(opt, "direct") == 0) {
+    data->direct = true;
+    return 1;
+  }
+
+  if (strcmp(opt, "direct-margin") == 0 && next) {
+    long samples;
+    if (parse_int(next, &samples) && samples >= 0) {
+      data->direct_margin = samples;
+      return 2;
+    }
+    fprintf(stderr, "Wrong direct mode margin value.\n");
+    return 0;
+  }
+
+  if (strcmp(opt, "dma-samples") == 0 && next) {
+    long samples;
+    if (parse_int(next, &samples) && samples >= 256 && samples <= (1 << 20)) {
+      data->dma_samples = (samples + JACKPIFM_PAGESAMPLES - 1) / JACKPIFM_PAGESAMPLES * JACKPIFM_PAGESAMPLES;
+      return 2;
+    }
+    fprintf(stderr, "Wrong DMA ring size, must be between 256 and 1048576 samples.\n");
+    return 0;
+  }
+
+  if (strcmp(opt, "sync") == 0 && next) {
+    if (strcmp(next, "dma") == 0 || strcmp(next, "resamp") == 0) {
+      data->sync_resamp = strcmp(next, "resamp") == 0;
+      return 2;
+    }
+    fprintf(stderr, "Wrong sync mode, must be 'dma' or 'resamp'.\n");
+    return 0;
+  }
+
+  if (strcmp(opt, "ctl-smooth") == 0 && next) {
+    long value;
+    if (parse_int(next, &value) && value >= 2 && value < 1e9) {
+      data->ctl_smooth = value;
+      return 2;
+    }
+    fprintf(stderr, "Wrong controller smoothing value.\n");
+    return 0;
+  }
+
+  if (strcmp(opt, "ctl-catch") == 0 && next) {
+    long value;
+    if (parse_int(next, &value) && value >= 1 && value < 1e9) {
+      data->ctl_catch = value;
+      return 2;
+    }
+    fprintf(stderr, "Wrong controller catch factor value.\n");
+    return 0;
+  }
+
+  if (strcmp(opt, "ctl-catch2") == 0 && next) {
+    long value;
+    if (parse_int(next, &value) && value >= 1 && value < 1e9) {
+      data->ctl_catch2 = value;
+      return 2;
+    }
+    fprintf(stderr, "Wrong controller catch factor 2 value.\n");
+    return 0;
+  }
+
+  if (strcmp(opt, "ctl-pclamp") == 0 && next) {
+    double value;
+    if (parse_float(next, &value) && value >= 0) {
+      data->ctl_pclamp = value;
+      return 2;
+    }
+    fprintf(stderr, "Wrong controller P clamp value.\n");
+    return 0;
+  }
+
+  if (strcmp(opt, "ctl-quant") == 0 && next) {
+    double value;
+    if (parse_float(next, &value) && value > 0) {
+      data->ctl_quant = value;
+      return 2;
+    }
+    fprintf(stderr, "Wrong controller quantization value.\n");
+    return 0;
+  }
+
+  if (strcmp(opt, "ctl-max") == 0 && next) {
+    double value;
+    if (parse_float(next, &value) && value >= 1) {
+      data->ctl_max_factor = value;
+      return 2;
+    }
+    fprintf(stderr, "Wrong controller maximum factor value.\n");
+    return 0;
+  }
+
+  if (strcmp(opt, "ctl-min") == 0 && next) {
+    double value;
+    if (parse_float(next, &value) && value > 0 && value <= 1) {
+      data->ctl_min_factor = value;
+      return 2;
+    }
+    fprintf(stderr, "Wrong controller minimum factor value.\n");
+    return 0;
+  }
+
   if (strcmp(opt, "name") == 0 && next) {
     data->name = next;
     return 2;
@@ -347,6 +632,75 @@ static int parse_long_option(char *opt, char *next, void *opaque) {
     return 1;
   }
 
+  if (strcmp(opt, "render") == 0 && next) {
+    data->render_file = next;
+    return 2;
+  }
+
+  if (strcmp(opt, "output") == 0 && next) {
+    data->output_file = next;
+    return 2;
+  }
+
+  if (strcmp(opt, "output-cb") == 0) {
+    data->output_cb = true;
+    return 1;
+  }
+
+  if (strcmp(opt, "render-rate") == 0 && next) {
+    long rate;
+    if (parse_int(next, &rate) && rate > 0 && rate < 1e7) {
+      data->render_rate = rate;
+      return 2;
+    }
+    fprintf(stderr, "Wrong render rate value.\n");
+    return 0;
+  }
+
+  if (strcmp(opt, "rt") == 0) {
+    data->rt = true;
+    return 1;
+  }
+
+  if (strcmp(opt, "rt-priority") == 0 && next) {
+    long priority;
+    if (parse_int(next, &priority) && priority >= 1 && priority <= 99) {
+      data->rt_priority = priority;
+      return 2;
+    }
+    fprintf(stderr, "Wrong real-time priority value.\n");
+    return 0;
+  }
+
+  if (strcmp(opt, "rt-cpu") == 0 && next) {
+    long cpu;
+    if (parse_int(next, &cpu) && cpu >= 0 && cpu < 1024) {
+      data->rt_cpu = cpu;
+      return 2;
+    }
+    fprintf(stderr, "Wrong CPU number.\n");
+    return 0;
+  }
+
+  if (strcmp(opt, "encoder") == 0 && next) {
+    if (strcmp(next, "float") == 0 || strcmp(next, "fixed") == 0) {
+      data->fixed_point = strcmp(next, "fixed") == 0;
+      return 2;
+    }
+    fprintf(stderr, "Wrong encoder, must be 'float' or 'fixed'.\n");
+    return 0;
+  }
+
+  if (strcmp(opt, "verify-encoder") == 0) {
+    data->verify_encoder = true;
+    return 1;
+  }
+
+  if (strcmp(opt, "telemetry") == 0 && next) {
+    data->telemetry = next;
+    return 2;
+  }
+
   if (strcmp(opt, "help") == 0) {
     print_help(data->basename);
     data->done = 1;
@@ -391,8 +745,36 @@ static void parse_jackpifm_options(client_options *data, int argc, char **argv)
     fprintf(stderr, "To use --stereo or --rds you must also enable --resamp.\n");
     exit(1);
   }
+  if (data->preemp_mpx && !data->resample) {
+    fprintf(stderr, "To use --preemp-mpx you must also enable --resamp.\n");
+    exit(1);
+  }
+  if (data->sync_resamp && !data->resample) {
+    fprintf(stderr, "To use --sync=resamp you must also enable --resamp.\n");
+    exit(1);
+  }
+  if (!data->ctl_quant)
+    data->ctl_quant = data->sync_resamp ? 1e7 : 10000;
+  if (data->verify_encoder && data->fixed_point) {
+    fprintf(stderr, "--verify-encoder only checks the float encoder, use --encoder=float.\n");
+    exit(1);
+  }
+  if (!data->render_file != !data->output_file) {
+    fprintf(stderr, "--render and --output must be used together.\n");
+    exit(1);
+  }
+  if (data->direct_margin > data->dma_samples / 2) {
+    fprintf(stderr, "Direct mode margin (%zu) cannot be greater than half the DMA ring (%zu).\n", data->direct_margin, data->dma_samples);
+    exit(1);
+  }
+  // (the output thread waits for up to a period to fit in the ring; longer than
+  // half of it, and the DMA could lap the write position unnoticed)
+  if (!data->direct && 2 * data->period_size > data->dma_samples) {
+    fprintf(stderr, "Period size (%zu) cannot be greater than half the DMA ring (%zu).\n", data->period_size, data->dma_samples);
+    exit(1);
+  }
   if (data->period_size >= data->ringsize) {
-    fprintf(stderr, "Period size (%d) cannot be greater than ringsize (%d).\n", data->period_size, data->ringsize);
+    fprintf(stderr, "Period size (%zu) cannot be greater than ringsize (%zu).\n", data->period_size, data->ringsize);
     exit(1);
   }
 
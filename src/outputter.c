@@ -1,6 +1,5 @@
 #include "outputter.h"
 
-#include <malloc.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
@@ -10,6 +9,8 @@
 #include <sys/mman.h>
 #include <assert.h>
 
+#include "pagepool.h"
+
 #define PAGE_SIZE (4*1024)
 #define BLOCK_SIZE (4*1024)
 
@@ -30,7 +31,7 @@ char *spi0_mem, *spi0_map;
 #define GPIO_CLR *(gpio+10) // clears bits which are 1 ignores bits which are 0
 #define GPIO_GET *(gpio+13)  // sets   bits which are 1 ignores bits which are 0
 
-#define ACCESS(base) *(volatile int*)((int)allof7e+base-0x7e000000)
+#define ACCESS(base) *(volatile int*)((uintptr_t)allof7e+base-0x7e000000)
 #define SETBIT(base, bit) ACCESS(base) |= 1<<bit
 #define CLRBIT(base, bit) ACCESS(base) &= ~(1<<bit)
 
@@ -53,25 +54,12 @@ struct GPCTL {
   char PASSWD      : 8;
 };
 
-static void get_real_mem_page(void** vAddr, void** pAddr) {
-  void* a = valloc(4096);
-  ((int*)a)[0] = 1;  /* use page to force allocation */
-
-  mlock(a, 4096);  /* lock into RAM */
-  *vAddr = a;  /* yay - we know the virtual address */
-
-  unsigned long long frameinfo;
-
-  int fp = open("/proc/self/pagemap", O_RDONLY);
-  lseek(fp, ((int)a)/4096*8, SEEK_SET);
-  read(fp, &frameinfo, sizeof(frameinfo));
-
-  *pAddr = (void*)((int)(frameinfo*4096));
+static void *get_real_mem_pages(size_t count, uint32_t *baddrs) {
+  return jackpifm_pagepool_alloc(count, baddrs, "/proc/self/pagemap");
 }
 
-static void free_real_mem_page(void* vAddr) {
-  munlock(vAddr, 4096);  /* unlock RAM */
-  free(vAddr);
+static void free_real_mem_pages(void *region, size_t count) {
+  jackpifm_pagepool_release(region, count);
 }
 
 
@@ -91,7 +79,7 @@ int jackpifm_setup_fm() {
       0x20000000  //base
   );
 
-  if ((int)allof7e==-1) return 1;
+  if (allof7e == MAP_FAILED) return 1;
 
   SETBIT(GPFSEL0 , 14);
   CLRBIT(GPFSEL0 , 13);
@@ -103,17 +91,6 @@ int jackpifm_setup_fm() {
 }
 
 
-struct CB {
-  volatile unsigned int TI;
-  volatile unsigned int SOURCE_AD;
-  volatile unsigned int DEST_AD;
-  volatile unsigned int TXFR_LEN;
-  volatile unsigned int STRIDE;
-  volatile unsigned int NEXTCONBK;
-  volatile unsigned int RES1;
-  volatile unsigned int RES2;
-};
-
 struct DMAregs {
   volatile unsigned int CS;
   volatile unsigned int CONBLK_AD;
@@ -126,39 +103,220 @@ struct DMAregs {
   volatile unsigned int DEBUG;
 };
 
+static struct timespec millisecond_wait = {0, 1e6};
+
 struct PageInfo {
-  void* p;  // physical address
+  uint32_t p;  // physical (bus) address
   void* v;   // virtual address
 };
 
 struct PageInfo constPage;
 struct PageInfo instrPage;
-#define BUFFERINSTRUCTIONS JACKPIFM_BUFFERINSTRUCTIONS
-struct PageInfo instrs[BUFFERINSTRUCTIONS];
+
+// Control block ring, 4 blocks per sample (see jackpifm_setup_dma)
+static struct PageInfo *instrs = NULL;
+static size_t bufferSamples = 0;
+static int bufferInstructions = 0;
+
+// DMA memory: the clock divider page, then the control block pages
+#define PAGE_INSTRUCTIONS (PAGE_SIZE / sizeof(struct CB))
+static void *dmaRegion = NULL;
+static size_t dmaPages = 0;
+static uint32_t *pageBus = NULL;  // bus address of each page
+static jackpifm_pagetable_t *pageTable = NULL;
 
 
+// Hardware DMA backend
+
+static void hw_start(uint32_t first_block) {
+  // set up a clock for the PWM
+  ACCESS(CLKBASE + 40*4 /*PWMCLK_CNTL*/) = 0x5A000026;
+  nanosleep(&millisecond_wait, NULL);
+  ACCESS(CLKBASE + 41*4 /*PWMCLK_DIV*/)  = 0x5A002800;
+  ACCESS(CLKBASE + 40*4 /*PWMCLK_CNTL*/) = 0x5A000016;
+  nanosleep(&millisecond_wait, NULL);
+
+  // set up PWM
+  ACCESS(PWMBASE + 0x0 /* CTRL*/) = 0;
+  nanosleep(&millisecond_wait, NULL);
+  ACCESS(PWMBASE + 0x4 /* status*/) = -1;  // clear errors
+  nanosleep(&millisecond_wait, NULL);
+  ACCESS(PWMBASE + 0x0 /* CTRL*/) = -1; //(1<<13 /* Use fifo */) | (1<<10 /* repeat */) | (1<<9 /* serializer */) | (1<<8 /* enable ch */) ;
+  nanosleep(&millisecond_wait, NULL);
+  ACCESS(PWMBASE + 0x8 /* DMAC*/) = (1<<31 /* DMA enable */) | 0x0707;
+
+  //activate DMA
+  struct DMAregs* DMA0 = (struct DMAregs*)&(ACCESS(DMABASE));
+  DMA0->CS =1<<31;  // reset
+  DMA0->CONBLK_AD=0;
+  DMA0->TI=0;
+  DMA0->CONBLK_AD = first_block;
+  DMA0->CS =(1<<0)|(255 <<16);  // enable bit = 0, clear end flag = 1, prio=19-16
+}
+
+static void hw_stop(void) {
+  struct DMAregs* DMA0 = (struct DMAregs*)&(ACCESS(DMABASE));
+  DMA0->CS= 1<<31;  // reset DMA controller
+}
+
+static uint32_t hw_current_block(void) {
+  return ACCESS(DMABASE + 0x04 /* CurBlock*/);
+}
+
+static void hw_now(struct timespec *time) {
+  clock_gettime(CLOCK_MONOTONIC, time);
+}
+
+static void hw_sleep_until(const struct timespec *deadline) {
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL) == EINTR);
+}
+
+const jackpifm_dma_backend_t jackpifm_hw_dma = {
+  get_real_mem_pages,
+  free_real_mem_pages,
+  hw_start,
+  hw_stop,
+  hw_current_block,
+  hw_now,
+  hw_sleep_until,
+};
+
+static const jackpifm_dma_backend_t *dma = &jackpifm_hw_dma;
+
+void jackpifm_outputter_set_backend(const jackpifm_dma_backend_t *backend) {
+  dma = backend;
+}
+
+
+#define CLOCKS_PER_SAMPLE(rate) (22500.0 / (rate) * 1373.5)  // for timing, determined by experiment
+
 static int bufPtr = 0;
+static int dmaPtr = 0;  // last known DMA position (first instruction of the sample)
+static int cleanPtr = 0;  // the blocks from bufPtr up to here hold silence (see silence_ahead)
+static double sampleRate;
 static float clocksPerSample;
-static struct timespec sleeptime = {0, 0};
+static double clocksCorrection;  // (1.0-2.3/clocksPerSample), see encode_scalar
 static float fracerror = 0;
 static float timeErr = 0;
 
+// Samples are encoded in blocks of this size, into structure-of-arrays scratch buffers
+#define ENCODE_BLOCK 256
+static int enc_intval[ENCODE_BLOCK];
+static unsigned int enc_fracval[ENCODE_BLOCK];
+static unsigned int enc_lowlen[ENCODE_BLOCK];
+
+// Samples silenced past the write position per write, on top of those written (see silence_ahead)
+#define SILENCE_BLOCK 256
+
+static bool verify = false;
+static size_t mismatches = 0;
+
+// Fixed-point encoder state, in Q16.16 (see encode_fixed)
+#define FIX_ONE 65536
+static bool fixed = false;
+static int32_t fixError;      // fracerror
+static uint32_t fixTime;      // fractional part of timeErr
+static uint32_t fixClocks;    // clocksPerSample
+static uint64_t fixCorrection;  // clocksCorrection / clocksPerSample, in Q0.32
+
+static uint64_t stat_reads = 0;
+static uint64_t stat_wakeups = 0;
+
+// Marked samples, followed until the DMA emits them (see jackpifm_outputter_mark).
+// Positions count samples written into the ring; marks in [markHead, markDone)
+// have been emitted, those in [markDone, markTail) not yet.
+#define MARKS 64
+typedef struct {
+  int64_t sample;
+  uint64_t time;
+  uint64_t emitted;
+} mark_t;
+static mark_t marks[MARKS];
+static size_t markHead = 0, markDone = 0, markTail = 0;
+static int64_t written = 0;  // samples written since the last sync (and the ring then)
+
 void jackpifm_outputter_setup(double sample_rate, size_t period_size) {
-  //sleeptime = (float)1e9 * BUFFERINSTRUCTIONS/(4 * sample_rate *2));
-  sleeptime.tv_nsec = round(((double)1e9 * period_size) / sample_rate);
-  clocksPerSample = 22500.0 / sample_rate * 1373.5;  // for timing, determined by experiment
+  sampleRate = sample_rate;
+  clocksPerSample = CLOCKS_PER_SAMPLE(sample_rate);
+  clocksCorrection = 1.0-2.3/clocksPerSample;
+  fixClocks = lrint(clocksPerSample * FIX_ONE);
+  fixCorrection = llrint(clocksCorrection / clocksPerSample * 4294967296.0);
+}
+
+size_t jackpifm_outputter_queued() {
+  return bufferSamples - ((bufferInstructions + dmaPtr - bufPtr) % bufferInstructions) / 4;
+}
+
+void jackpifm_outputter_verify(bool enable) {
+  verify = enable;
+}
+
+size_t jackpifm_outputter_mismatches() {
+  return mismatches;
+}
+
+void jackpifm_outputter_stats(uint64_t *reads, uint64_t *wakeups) {
+  *reads = stat_reads;
+  *wakeups = stat_wakeups;
+}
+
+// Index of the instruction at bus address `pos`
+static int instruction_index(uint32_t pos) {
+  long page = jackpifm_pagetable_find(pageTable, pos);
+  if (page < 1) abort();  // We should never get here
+  return (page - 1) * PAGE_INSTRUCTIONS + (pos % PAGE_SIZE) / sizeof(struct CB);
 }
 
 void jackpifm_outputter_sync() {
-  void *pos = (void *)(ACCESS(DMABASE + 0x04 /* CurBlock*/) & ~ 0x7F);
-  for (bufPtr = 0; bufPtr < BUFFERINSTRUCTIONS; bufPtr += 4)
-    if (instrs[bufPtr].p == pos) return;
+  uint32_t pos = dma->current_block() & ~ 0x7F;
+  stat_reads++;
+  bufPtr = dmaPtr = cleanPtr = instruction_index(pos);
+  written = bufferSamples;  // (the ring counts as full, the DMA is emitting its first sample)
+  markHead = markDone = markTail = 0;
+}
 
-  // We should never get here
-  abort();
+// Time the marks the DMA has gone past, given the samples still queued
+static void check_marks(size_t queued) {
+  int64_t position = written - (int64_t)queued;  // sample the DMA is emitting
+  struct timespec now;
+  dma->now(&now);
+  uint64_t now_ns = now.tv_sec * 1000000000ull + now.tv_nsec;
+
+  for (; markDone != markTail; markDone++) {
+    mark_t *mark = &marks[markDone % MARKS];
+    if (mark->sample >= position) break;
+    mark->emitted = now_ns - (uint64_t)((position - mark->sample) * 1e9 / sampleRate);
+  }
 }
 
-void jackpifm_outputter_output(const jackpifm_sample_t *data, size_t size) {
+// Read the DMA position (once) and return how many samples can be written
+// from bufPtr without reaching the sample the DMA is executing.
+static size_t free_samples() {
+  uint32_t pos = dma->current_block() & ~ 0x7F;
+  stat_reads++;
+
+  dmaPtr = instruction_index(pos);
+
+  size_t free = ((bufferInstructions + dmaPtr - bufPtr) % bufferInstructions) / 4;
+  if (markDone != markTail) check_marks(bufferSamples - free);
+  return free;
+}
+
+// Sleep until the DMA has (predictably) freed `samples` more samples
+static void wait_samples(size_t samples) {
+  struct timespec deadline;
+  dma->now(&deadline);
+  long long nsec = deadline.tv_nsec + (long long)ceil(samples * 1e9 / sampleRate);
+  deadline.tv_sec += nsec / 1000000000;
+  deadline.tv_nsec = nsec % 1000000000;
+
+  dma->sleep_until(&deadline);
+  stat_wakeups++;
+}
+
+// Reference encoder: computes the divider offset and the PWM "HIGH" and "LOW"
+// lengths for each sample, one sample at a time. Kept to verify encode_batch.
+static void encode_scalar(const jackpifm_sample_t *data, size_t size, int *intvals, unsigned int *fracvals, unsigned int *lowlens) {
   for (size_t i = 0; i < size; i++) {
     float value = data[i];
     value *= 8;          // modulation index (AKA volume!)
@@ -183,38 +341,322 @@ void jackpifm_outputter_output(const jackpifm_sample_t *data, size_t size) {
     // To reduce noise, rather than just rounding to the nearest clock we can use, we PWM between
     // the two nearest values.
 
-    // delay if necessary.  We can also print debug stuff here while not breaking timing.
-    static int time;
-    time++;
+    intvals[i] = intval;
+    fracvals[i] = fracval;
+    lowlens[i] = (int)timeErr-fracval;
+  }
+}
 
-    while( (ACCESS(DMABASE + 0x04 /* CurBlock*/) & ~ 0x7F) ==  (int)(instrs[bufPtr].p)) {
-      nanosleep(&sleeptime, NULL);  // are we anywhere in the next 4 instructions?
-    }
+// Batch encoder: same results as encode_scalar, bit for bit, but split in passes
+// so that only the delta-sigma recurrence is left in a serial loop. The other
+// passes are plain element-wise loops the compiler can vectorize.
+static void encode_batch(const jackpifm_sample_t *data, size_t size, int *intvals, unsigned int *fracvals, unsigned int *lowlens) {
+  float scaled[ENCODE_BLOCK];
+  int times[ENCODE_BLOCK];
+  float cps = clocksPerSample;
+  double correction = clocksCorrection;
+
+  // Scale to modulation index
+  for (size_t i = 0; i < size; i++)
+    scaled[i] = data[i] * 8;
+
+  // Delta-sigma recurrence (roundf gives the same result as round on floats)
+  float error = fracerror;
+  for (size_t i = 0; i < size; i++) {
+    float value = scaled[i] + error;
+    float intval = roundf(value);
+    float frac = (value - intval + 1) * 0.5f;
+    float fracval = roundf(frac * cps);
+    error = (frac - fracval*correction/cps)*2;
+    intvals[i] = (int)intval;
+    fracvals[i] = (unsigned int)fracval;
+  }
+  fracerror = error;
 
+  // Time error recurrence, which doesn't depend on the samples
+  float terr = timeErr;
+  for (size_t i = 0; i < size; i++) {
+    terr = terr - (int)(terr) + cps;
+    times[i] = (int)terr;
+  }
+  timeErr = terr;
+
+  // PWM "LOW" lengths
+  for (size_t i = 0; i < size; i++)
+    lowlens[i] = times[i] - fracvals[i];
+}
+
+// Fixed-point encoder, for CPUs where float rounding and conversions are slow.
+// Same passes and recurrences as encode_batch, but the errors are kept in Q16.16
+// and the only float operation left is converting the input. The results differ
+// from the float encoders by a rounding here and there, which the delta-sigma
+// loop then absorbs like any other quantization error.
+static void encode_fixed(const jackpifm_sample_t *data, size_t size, int *intvals, unsigned int *fracvals, unsigned int *lowlens) {
+  int32_t scaled[ENCODE_BLOCK];
+  int times[ENCODE_BLOCK];
+  uint32_t cps = fixClocks;
+  uint64_t correction = fixCorrection;
+
+  // Scale to modulation index, in Q16.16
+  for (size_t i = 0; i < size; i++)
+    scaled[i] = (int32_t)(data[i] * (8.0f * FIX_ONE));
+
+  // Delta-sigma recurrence
+  int32_t error = fixError;
+  for (size_t i = 0; i < size; i++) {
+    int32_t value = scaled[i] + error;
+    int32_t intval = (value + FIX_ONE/2) >> 16;
+    uint32_t frac = (uint32_t)(value - intval * FIX_ONE + FIX_ONE) >> 1;
+    uint32_t fracval = ((uint64_t)frac * cps + (1ull << 31)) >> 32;
+    error = ((int32_t)frac - (int32_t)((fracval * correction + (1 << 15)) >> 16)) * 2;
+    intvals[i] = intval;
+    fracvals[i] = fracval;
+  }
+  fixError = error;
+
+  // Time error recurrence
+  uint32_t terr = fixTime;
+  for (size_t i = 0; i < size; i++) {
+    terr = (terr & (FIX_ONE - 1)) + cps;
+    times[i] = terr >> 16;
+  }
+  fixTime = terr;
+
+  // PWM "LOW" lengths
+  for (size_t i = 0; i < size; i++)
+    lowlens[i] = times[i] - fracvals[i];
+}
+
+void jackpifm_outputter_fixed(bool enable) {
+  // Carry the encoder state over, so switching doesn't click
+  if (enable && !fixed) {
+    fixError = lrintf(fracerror * FIX_ONE);
+    fixTime = lrintf((timeErr - (int)timeErr) * FIX_ONE);
+  } else if (!enable && fixed) {
+    fracerror = fixError / (float)FIX_ONE;
+    timeErr = (fixTime & (FIX_ONE - 1)) / (float)FIX_ONE;
+  }
+  fixed = enable;
+}
+
+// Run the reference encoder from the same state and compare
+static void verify_block(const jackpifm_sample_t *data, size_t size, float old_fracerror, float old_timeErr) {
+  int intvals[ENCODE_BLOCK];
+  unsigned int fracvals[ENCODE_BLOCK], lowlens[ENCODE_BLOCK];
+  float new_fracerror = fracerror, new_timeErr = timeErr;
+
+  fracerror = old_fracerror;
+  timeErr = old_timeErr;
+  encode_scalar(data, size, intvals, fracvals, lowlens);
+
+  for (size_t i = 0; i < size; i++)
+    if (intvals[i] != enc_intval[i] || fracvals[i] != enc_fracval[i] || lowlens[i] != enc_lowlen[i])
+      mismatches++;
+  if (memcmp(&fracerror, &new_fracerror, sizeof(float)) || memcmp(&timeErr, &new_timeErr, sizeof(float)))
+    mismatches++;
+
+  fracerror = new_fracerror;
+  timeErr = new_timeErr;
+}
+
+void jackpifm_outputter_drain() {
+  size_t writable = free_samples();
+  wait_samples((writable ? bufferSamples - writable : bufferSamples) + 1);
+}
+
+// Encode `n` (up to ENCODE_BLOCK) samples into the scratch buffers
+static void encode_block(const jackpifm_sample_t *data, size_t n) {
+  if (fixed) {
+    encode_fixed(data, n, enc_intval, enc_fracval, enc_lowlen);
+    return;
+  }
+  float old_fracerror = fracerror, old_timeErr = timeErr;
+  encode_batch(data, n, enc_intval, enc_fracval, enc_lowlen);
+  if (verify) verify_block(data, n, old_fracerror, old_timeErr);
+}
+
+// Write encoded samples [i, end) into the control blocks at bufPtr
+static void scatter(size_t i, size_t end) {
+  uint32_t source = constPage.p + 2048;
+  written += end - i;
+  for (; i < end; i++) {
     // Create DMA command to set clock controller to output FM signal for PWM "LOW" time.
-    ((struct CB*)(instrs[bufPtr].v))->SOURCE_AD = (int)constPage.p + 2048 + intval*4 - 4 ;
+    ((struct CB*)(instrs[bufPtr].v))->SOURCE_AD = source + enc_intval[i]*4 - 4;
     bufPtr++;
 
     // Create DMA command to delay using serializer module for suitable time.
-    ((struct CB*)(instrs[bufPtr].v))->TXFR_LEN = (int)timeErr-fracval;
+    ((struct CB*)(instrs[bufPtr].v))->TXFR_LEN = enc_lowlen[i];
     bufPtr++;
 
     // Create DMA command to set clock controller to output FM signal for PWM "HIGH" time.
-    ((struct CB*)(instrs[bufPtr].v))->SOURCE_AD = (int)constPage.p + 2048 + intval*4 + 4;
+    ((struct CB*)(instrs[bufPtr].v))->SOURCE_AD = source + enc_intval[i]*4 + 4;
     bufPtr++;
 
     // Create DMA command for more delay.
-    ((struct CB*)(instrs[bufPtr].v))->TXFR_LEN = fracval;
-    bufPtr=(bufPtr+1) % (BUFFERINSTRUCTIONS);
+    ((struct CB*)(instrs[bufPtr].v))->TXFR_LEN = enc_fracval[i];
+    bufPtr=(bufPtr+1) % (bufferInstructions);
   }
 }
 
+void jackpifm_outputter_encode(const jackpifm_sample_t *data, size_t size, int *intvals, unsigned int *lowlens, unsigned int *fracvals) {
+  while (size) {
+    size_t n = (size < ENCODE_BLOCK) ? size : ENCODE_BLOCK;
+    encode_block(data, n);
+    memcpy(intvals, enc_intval, n * sizeof(int));
+    memcpy(lowlens, enc_lowlen, n * sizeof(unsigned int));
+    memcpy(fracvals, enc_fracval, n * sizeof(unsigned int));
+
+    data += n;
+    intvals += n;
+    lowlens += n;
+    fracvals += n;
+    size -= n;
+  }
+}
 
-static struct timespec millisecond_wait = {0, 1e6};
+void jackpifm_outputter_output(const jackpifm_sample_t *data, size_t size) {
+  while (size) {
+    size_t n = (size < ENCODE_BLOCK) ? size : ENCODE_BLOCK;
+    encode_block(data, n);
+
+    // Scatter into the control blocks, as many at a time as the DMA allows
+    for (size_t i = 0; i < n; ) {
+      size_t writable = free_samples();
+      if (!writable) {
+        // The ring is full; sleep until there's room for everything left
+        wait_samples(size - i);
+        continue;
+      }
+      if (writable > n - i) writable = n - i;
+      scatter(i, i + writable);
+      i += writable;
+    }
 
-void jackpifm_setup_dma(float center_freq) {
-  // allocate a few pages of ram
-  get_real_mem_page(&constPage.v, &constPage.p);
+    data += n;
+    size -= n;
+  }
+}
+
+// Fill the blocks from bufPtr up to the DMA with silence, without moving bufPtr:
+// if the writes stop, the DMA then runs into silence rather than the last lap.
+// Only the blocks the DMA went past since the last call need it (from cleanPtr
+// on), unless the write position went past cleanPtr too. At most `samples` are
+// silenced per call, so after a seek the rest of the ring is caught up over the
+// next writes rather than all at once in the JACK callback.
+static void silence_ahead(size_t samples) {
+  int ahead = (bufferInstructions + dmaPtr - bufPtr) % bufferInstructions;
+  int clean = (bufferInstructions + cleanPtr - bufPtr) % bufferInstructions;
+  if (clean > ahead) clean = 0;
+  if ((size_t)(ahead - clean) / 4 > samples) ahead = clean + samples * 4;
+
+  uint32_t source = constPage.p + 2048;
+  unsigned int len = round(clocksPerSample / 2);
+  for (int i = bufPtr + clean, end = bufPtr + ahead; i < end; i += 4) {
+    int p = i % bufferInstructions;
+    ((struct CB*)(instrs[p].v))->SOURCE_AD = source;
+    ((struct CB*)(instrs[p+1].v))->TXFR_LEN = len;
+    ((struct CB*)(instrs[p+2].v))->SOURCE_AD = source;
+    ((struct CB*)(instrs[p+3].v))->TXFR_LEN = len;
+  }
+  cleanPtr = (bufPtr + ahead) % bufferInstructions;
+}
+
+size_t jackpifm_outputter_write(const jackpifm_sample_t *data, size_t size) {
+  size_t writable = free_samples();
+  if (size > writable) size = writable;
+
+  for (size_t done = 0; done < size; ) {
+    size_t n = (size - done < ENCODE_BLOCK) ? size - done : ENCODE_BLOCK;
+    encode_block(data + done, n);
+    scatter(0, n);
+    done += n;
+  }
+  // (besides the blocks the DMA went past, which are about as many as written)
+  silence_ahead(size + SILENCE_BLOCK);
+  return size;
+}
+
+size_t jackpifm_outputter_lead() {
+  return bufferSamples - free_samples();
+}
+
+void jackpifm_outputter_seek(size_t lead) {
+  static const jackpifm_sample_t silence[ENCODE_BLOCK];
+  size_t free = free_samples();
+  bufPtr = dmaPtr;
+
+  // Queued samples are discarded, and marks among them won't be emitted
+  written -= (int64_t)(bufferSamples - free);
+  markTail = markDone;
+
+  // The blocks in between get silence, instead of whatever they had from the last lap
+  while (lead) {
+    size_t n = (lead < ENCODE_BLOCK) ? lead : ENCODE_BLOCK;
+    encode_block(silence, n);
+    scatter(0, n);
+    lead -= n;
+  }
+  cleanPtr = bufPtr;
+}
+
+void jackpifm_outputter_mute() {
+  // Keep the sample the DMA is executing, silence all the others
+  jackpifm_outputter_seek(1);
+  silence_ahead(bufferSamples);
+}
+
+
+void jackpifm_outputter_mark(size_t offset, uint64_t time) {
+  if (markTail - markHead >= MARKS) return;
+  mark_t *mark = &marks[markTail++ % MARKS];
+  mark->sample = written + offset;
+  mark->time = time;
+}
+
+bool jackpifm_outputter_poll_mark(uint64_t *time, uint64_t *emitted) {
+  if (markHead == markDone) return false;
+  mark_t *mark = &marks[markHead++ % MARKS];
+  *time = mark->time;
+  *emitted = mark->emitted;
+  return true;
+}
+
+
+static void release_pages() {
+  if (!dmaRegion) return;
+  dma->free_pages(dmaRegion, dmaPages);
+  jackpifm_pagetable_free(pageTable);
+  free(pageBus);
+  dmaRegion = NULL;
+  pageTable = NULL;
+  pageBus = NULL;
+}
+
+size_t jackpifm_outputter_buffer_samples() {
+  return bufferSamples;
+}
+
+void jackpifm_setup_dma(float center_freq, size_t samples) {
+  // Round the ring up to whole pages of control blocks
+  if (samples < JACKPIFM_PAGESAMPLES) samples = JACKPIFM_PAGESAMPLES;
+  bufferSamples = (samples + JACKPIFM_PAGESAMPLES - 1) / JACKPIFM_PAGESAMPLES * JACKPIFM_PAGESAMPLES;
+  bufferInstructions = bufferSamples * 4;
+  free(instrs);
+  instrs = jackpifm_calloc(bufferInstructions, sizeof(struct PageInfo));
+  bufPtr = dmaPtr = cleanPtr = 0;
+
+  // allocate all the pages at once: one for the clock divider values, the rest for instructions
+  release_pages();
+  dmaPages = 1 + bufferInstructions / PAGE_INSTRUCTIONS;
+  pageBus = jackpifm_calloc(dmaPages, sizeof(uint32_t));
+  dmaRegion = dma->get_pages(dmaPages, pageBus);
+  if (!dmaRegion) {
+    fprintf(stderr, "Couldn't allocate memory for the DMA.\n");
+    abort();
+  }
+  pageTable = jackpifm_pagetable_new(pageBus, dmaPages);
+  constPage.v = dmaRegion;
+  constPage.p = pageBus[0];
 
   int centerFreqDivider = (int)((500.0 / center_freq) * (float)(1<<12) + 0.5);
 
@@ -223,20 +665,26 @@ void jackpifm_setup_dma(float center_freq) {
   for (int i=0; i<1024; i++)
     ((int*)(constPage.v))[i] = (0x5a << 24) + centerFreqDivider - 512 + i;
 
+  // Until the outputter writes them, samples are silence at the nominal rate
+  float clocks = clocksPerSample ? clocksPerSample : CLOCKS_PER_SAMPLE(152000);
+  unsigned int silenceLen = round(clocks / 2);
+
   int instrCnt = 0;
 
-  while (instrCnt<BUFFERINSTRUCTIONS) {
-    get_real_mem_page(&instrPage.v, &instrPage.p);
+  while (instrCnt<bufferInstructions) {
+    size_t page = 1 + instrCnt / PAGE_INSTRUCTIONS;
+    instrPage.v = (char*)dmaRegion + PAGE_SIZE*page;
+    instrPage.p = pageBus[page];
 
     // make copy instructions
     struct CB* instr0= (struct CB*)instrPage.v;
 
     for (size_t i=0; i<4096/sizeof(struct CB); i++) {
-      instrs[instrCnt].v = (void*)((int)instrPage.v + sizeof(struct CB)*i);
-      instrs[instrCnt].p = (void*)((int)instrPage.p + sizeof(struct CB)*i);
-      instr0->SOURCE_AD = (unsigned int)constPage.p+2048;
+      instrs[instrCnt].v = (char*)instrPage.v + sizeof(struct CB)*i;
+      instrs[instrCnt].p = instrPage.p + sizeof(struct CB)*i;
+      instr0->SOURCE_AD = constPage.p+2048;
       instr0->DEST_AD = PWMBASE+0x18 /* FIF1 */;
-      instr0->TXFR_LEN = 4;
+      instr0->TXFR_LEN = silenceLen;
       instr0->STRIDE = 0;
       //instr0->NEXTCONBK = (int)instrPage.p + sizeof(struct CB)*(i+1);
       instr0->TI = (1/* DREQ  */<<6) | (5 /* PWM */<<16) |  (1<<26/* no wide*/);
@@ -245,43 +693,22 @@ void jackpifm_setup_dma(float center_freq) {
 
       if (!(i%2)) {
         instr0->DEST_AD = CM_GP0DIV;
+        instr0->TXFR_LEN = 4;
         instr0->STRIDE = 4;
         instr0->TI = (1<<26/* no wide*/) ;
       }
 
-      if (instrCnt!=0) ((struct CB*)(instrs[instrCnt-1].v))->NEXTCONBK = (int)instrs[instrCnt].p;
+      if (instrCnt!=0) ((struct CB*)(instrs[instrCnt-1].v))->NEXTCONBK = instrs[instrCnt].p;
       instr0++;
       instrCnt++;
     }
   }
-  ((struct CB*)(instrs[BUFFERINSTRUCTIONS-1].v))->NEXTCONBK = (int)instrs[0].p;
-
-  // set up a clock for the PWM
-  ACCESS(CLKBASE + 40*4 /*PWMCLK_CNTL*/) = 0x5A000026;
-  nanosleep(&millisecond_wait, NULL);
-  ACCESS(CLKBASE + 41*4 /*PWMCLK_DIV*/)  = 0x5A002800;
-  ACCESS(CLKBASE + 40*4 /*PWMCLK_CNTL*/) = 0x5A000016;
-  nanosleep(&millisecond_wait, NULL);
+  ((struct CB*)(instrs[bufferInstructions-1].v))->NEXTCONBK = instrs[0].p;
 
-  // set up PWM
-  ACCESS(PWMBASE + 0x0 /* CTRL*/) = 0;
-  nanosleep(&millisecond_wait, NULL);
-  ACCESS(PWMBASE + 0x4 /* status*/) = -1;  // clear errors
-  nanosleep(&millisecond_wait, NULL);
-  ACCESS(PWMBASE + 0x0 /* CTRL*/) = -1; //(1<<13 /* Use fifo */) | (1<<10 /* repeat */) | (1<<9 /* serializer */) | (1<<8 /* enable ch */) ;
-  nanosleep(&millisecond_wait, NULL);
-  ACCESS(PWMBASE + 0x8 /* DMAC*/) = (1<<31 /* DMA enable */) | 0x0707;
-
-  //activate DMA
-  struct DMAregs* DMA0 = (struct DMAregs*)&(ACCESS(DMABASE));
-  DMA0->CS =1<<31;  // reset
-  DMA0->CONBLK_AD=0;
-  DMA0->TI=0;
-  DMA0->CONBLK_AD = (unsigned int)(instrPage.p);
-  DMA0->CS =(1<<0)|(255 <<16);  // enable bit = 0, clear end flag = 1, prio=19-16
+  dma->start(instrPage.p);
 }
 
 void jackpifm_unsetup_dma() {
-  struct DMAregs* DMA0 = (struct DMAregs*)&(ACCESS(DMABASE));
-  DMA0->CS= 1<<31;  // reset DMA controller
+  dma->stop();
+  release_pages();
 }
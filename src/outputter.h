@@ -1,27 +1,133 @@
-/* rds.h - encodes a chunk of RDS data into a 152kHz signal */
+/* outputter.h - emits samples at the GPIO through DMA control blocks */
 
 #ifndef JACKPIFM_OUTPUTTER_H
 #define JACKPIFM_OUTPUTTER_H
 
 #include "common.h"
 
+#include <time.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* Default size of the control block ring, in samples (4 blocks each) */
 #define JACKPIFM_BUFFERSAMPLES 8192
-#define JACKPIFM_BUFFERINSTRUCTIONS JACKPIFM_BUFFERSAMPLES * 4
+
+/* DMA control block, as laid out in memory */
+struct CB {
+  volatile unsigned int TI;
+  volatile unsigned int SOURCE_AD;
+  volatile unsigned int DEST_AD;
+  volatile unsigned int TXFR_LEN;
+  volatile unsigned int STRIDE;
+  volatile unsigned int NEXTCONBK;
+  volatile unsigned int RES1;
+  volatile unsigned int RES2;
+};
+
+/* DMA backend: provides the memory control blocks live in, and executes them.
+ * All addresses exchanged with the backend are 32-bit bus addresses. */
+typedef struct {
+  /* get_pages: allocate `count` locked 4KB pages as one zeroed region, storing the bus
+   *            address of each page in `baddrs`; returns the region, or NULL on failure */
+  void *(*get_pages)(size_t count, uint32_t *baddrs);
+  /* free_pages: release a region returned by get_pages */
+  void (*free_pages)(void *region, size_t count);
+  /* start: start executing the control block chain at the given bus address */
+  void (*start)(uint32_t first_block);
+  /* stop: stop the DMA engine */
+  void (*stop)(void);
+  /* current_block: bus address of the control block being executed (CONBLK_AD) */
+  uint32_t (*current_block)(void);
+  /* now: current time (CLOCK_MONOTONIC, or the backend's own clock) */
+  void (*now)(struct timespec *time);
+  /* sleep_until: wait, while the DMA engine keeps consuming control blocks, until `now` reaches `deadline` */
+  void (*sleep_until)(const struct timespec *deadline);
+} jackpifm_dma_backend_t;
+
+/* Control blocks are allocated in pages, so the ring holds a multiple of this many samples */
+#define JACKPIFM_PAGESAMPLES (4096 / sizeof(struct CB) / 4)
+
+/* jackpifm_hw_dma: the real DMA controller, accessed through /dev/mem */
+extern const jackpifm_dma_backend_t jackpifm_hw_dma;
+
+/* jackpifm_outputter_set_backend: select the DMA backend (must be called before setup) */
+void jackpifm_outputter_set_backend(const jackpifm_dma_backend_t *backend);
 
 int jackpifm_setup_fm();
-void jackpifm_setup_dma(float center_freq);
+/* jackpifm_setup_dma: build a ring of at least `samples` samples of silence (rounded
+ *                     up to JACKPIFM_PAGESAMPLES) and start the DMA on it */
+void jackpifm_setup_dma(float center_freq, size_t samples);
 void jackpifm_unsetup_dma();
 
 void jackpifm_outputter_setup(double sample_rate, size_t period_size);
 void jackpifm_outputter_sync();
 void jackpifm_outputter_output(const jackpifm_sample_t *data, size_t size);
 
+/* jackpifm_outputter_write: like jackpifm_outputter_output, but never waits: writes as
+ *                           many samples as fit ahead of the DMA and returns that count.
+ *                           The blocks past them are kept silent, so that if the writes
+ *                           stop, the DMA doesn't replay the last lap of the ring (after
+ *                           a seek, that's caught up over the next few writes). */
+size_t jackpifm_outputter_write(const jackpifm_sample_t *data, size_t size);
+
+/* jackpifm_outputter_lead: read the DMA position and return how many samples are
+ *                          written ahead of it (if the DMA has overtaken the last
+ *                          sample written, this is close to the whole ring) */
+size_t jackpifm_outputter_lead();
+
+/* jackpifm_outputter_seek: move the write position to `lead` samples ahead of the DMA,
+ *                          filling the control blocks in between with silence */
+void jackpifm_outputter_seek(size_t lead);
+
+/* jackpifm_outputter_mute: fill the whole ring with silence, past the sample the DMA
+ *                          is executing (for when the writes have stopped; seek before
+ *                          writing again) */
+void jackpifm_outputter_mute();
+
+/* jackpifm_outputter_drain: wait until the DMA has executed everything written so far */
+void jackpifm_outputter_drain();
+
+/* jackpifm_outputter_stats: number of DMA position reads and sleeps done so far */
+void jackpifm_outputter_stats(uint64_t *reads, uint64_t *wakeups);
+
+/* jackpifm_outputter_mark: tag the sample at `offset` in the next output or write call
+ *                          with `time` (in ns, CLOCK_MONOTONIC), to be told when the DMA
+ *                          emits it. Up to 64 marks can be pending, more are ignored; marks
+ *                          on samples discarded by seek or sync are dropped. */
+void jackpifm_outputter_mark(size_t offset, uint64_t time);
+
+/* jackpifm_outputter_poll_mark: get the time of the next mark the DMA has emitted, and
+ *                               when it was emitted (estimated from the DMA position).
+ *                               Returns false if there's none. */
+bool jackpifm_outputter_poll_mark(uint64_t *time, uint64_t *emitted);
+
+/* jackpifm_outputter_buffer_samples: size of the control block ring, in samples */
+size_t jackpifm_outputter_buffer_samples();
+
+/* jackpifm_outputter_queued: samples written but not yet executed by the DMA, as of
+ *                            the last time its position was read (doesn't read it again) */
+size_t jackpifm_outputter_queued();
+
+/* jackpifm_outputter_verify: also run the reference (per-sample) encoder on everything
+ *                            that's output, and count any difference with the batch encoder */
+void jackpifm_outputter_verify(bool enable);
+
+/* jackpifm_outputter_fixed: encode in fixed point, which avoids float rounding and
+ *                           conversions (slow on ARM11) at the cost of tiny deviations
+ *                           from the float encoder. Verify mode only covers the float one. */
+void jackpifm_outputter_fixed(bool enable);
+
+/* jackpifm_outputter_encode: run the encoder alone on `size` samples, storing the divider
+ *                            offset and PWM "LOW" and "HIGH" lengths of each (for benchmarks) */
+void jackpifm_outputter_encode(const jackpifm_sample_t *data, size_t size, int *intvals, unsigned int *lowlens, unsigned int *fracvals);
+
+/* jackpifm_outputter_mismatches: number of samples that didn't match in verify mode */
+size_t jackpifm_outputter_mismatches();
+
 #ifdef __cplusplus
 }
 #endif
 
-#endif /* JACKPIFM_RDS_H */
+#endif /* JACKPIFM_OUTPUTTER_H */
@@ -0,0 +1,120 @@
+#define _GNU_SOURCE
+#include "pagepool.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+/* Pagemap entries: bit 63 is "present", bits 0-54 the page frame number */
+#define PAGEMAP_PRESENT (1ull << 63)
+#define PAGEMAP_PFN_MASK ((1ull << 55) - 1)
+
+void *jackpifm_pagepool_alloc(size_t count, uint32_t *baddrs, const char *pagemap) {
+  size_t size = count * JACKPIFM_PAGE_SIZE;
+  void *region = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if (region == MAP_FAILED) {
+    fprintf(stderr, "Couldn't map %zu pages for the DMA: %s\n", count, strerror(errno));
+    return NULL;
+  }
+
+  // Lock, then write every page so it's backed by a frame before asking for it
+  if (mlock(region, size))
+    fprintf(stderr, "Couldn't lock the DMA pages: %s\n", strerror(errno));
+  memset(region, 0, size);
+
+  if (jackpifm_pagepool_resolve(pagemap, region, count, baddrs)) {
+    jackpifm_pagepool_release(region, count);
+    return NULL;
+  }
+  return region;
+}
+
+void jackpifm_pagepool_release(void *region, size_t count) {
+  if (!region) return;
+  munlock(region, count * JACKPIFM_PAGE_SIZE);
+  munmap(region, count * JACKPIFM_PAGE_SIZE);
+}
+
+int jackpifm_pagepool_resolve(const char *pagemap, const void *vaddr, size_t count, uint32_t *baddrs) {
+  int fd = open(pagemap, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Couldn't open '%s': %s\n", pagemap, strerror(errno));
+    return -1;
+  }
+
+  // The pages are contiguous, and so are their entries
+  size_t size = count * sizeof(uint64_t);
+  uint64_t *entries = jackpifm_malloc(size);
+  off_t offset = (uintptr_t)vaddr / JACKPIFM_PAGE_SIZE * sizeof(uint64_t);
+  ssize_t ret = pread(fd, entries, size, offset);
+  close(fd);
+
+  int result = 0;
+  if (ret != (ssize_t)size) {
+    fprintf(stderr, "Couldn't read '%s': %s\n", pagemap, ret < 0 ? strerror(errno) : "short read");
+    result = -1;
+  }
+  if (!result) result = jackpifm_pagepool_decode(entries, count, baddrs);
+
+  free(entries);
+  return result;
+}
+
+int jackpifm_pagepool_decode(const uint64_t *entries, size_t count, uint32_t *baddrs) {
+  for (size_t i = 0; i < count; i++) {
+    // Without CAP_SYS_ADMIN the kernel reports frame 0 for everything
+    uint64_t pfn = entries[i] & PAGEMAP_PFN_MASK;
+    if (!(entries[i] & PAGEMAP_PRESENT) || !pfn) {
+      fprintf(stderr, "Couldn't find the physical address of a DMA page (are we root?).\n");
+      return -1;
+    }
+    baddrs[i] = (uint32_t)(pfn * JACKPIFM_PAGE_SIZE);
+  }
+  return 0;
+}
+
+
+/* Open addressing hash from page bus address to page index; a slot holds index + 1,
+ * or 0 if it's empty. There are at least twice as many slots as pages. */
+struct jackpifm_pagetable_t {
+  size_t mask;
+  const uint32_t *baddrs;
+  uint32_t *slots;
+};
+
+static inline size_t pagetable_hash(const jackpifm_pagetable_t *table, uint32_t page) {
+  return ((page / JACKPIFM_PAGE_SIZE) * 0x9E3779B1u) & table->mask;
+}
+
+jackpifm_pagetable_t *jackpifm_pagetable_new(const uint32_t *baddrs, size_t count) {
+  jackpifm_pagetable_t *table = jackpifm_calloc(1, sizeof(jackpifm_pagetable_t));
+  size_t real_size = 1;
+  while (real_size < 2 * count) real_size <<= 1;
+
+  table->mask = real_size - 1;
+  table->baddrs = baddrs;
+  table->slots = jackpifm_calloc(real_size, sizeof(uint32_t));
+
+  for (size_t i = 0; i < count; i++) {
+    size_t slot = pagetable_hash(table, baddrs[i]);
+    while (table->slots[slot]) slot = (slot + 1) & table->mask;
+    table->slots[slot] = i + 1;
+  }
+  return table;
+}
+
+long jackpifm_pagetable_find(const jackpifm_pagetable_t *table, uint32_t addr) {
+  uint32_t page = addr & ~(uint32_t)(JACKPIFM_PAGE_SIZE - 1);
+  for (size_t slot = pagetable_hash(table, page); table->slots[slot]; slot = (slot + 1) & table->mask) {
+    uint32_t index = table->slots[slot] - 1;
+    if (table->baddrs[index] == page) return index;
+  }
+  return -1;
+}
+
+void jackpifm_pagetable_free(jackpifm_pagetable_t *table) {
+  if (!table) return;
+  free(table->slots);
+  free(table);
+}
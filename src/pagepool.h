@@ -0,0 +1,56 @@
+/* pagepool.h - locked memory for the DMA, and the bus addresses of its pages
+ *
+ * The DMA engine works with bus addresses, so every page handed to it has to stay
+ * in RAM and its physical frame has to be known. The pool allocates all of them as
+ * one region and resolves every frame with a single read of the pagemap. */
+
+#ifndef JACKPIFM_PAGEPOOL_H
+#define JACKPIFM_PAGEPOOL_H
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define JACKPIFM_PAGE_SIZE 4096
+
+/* jackpifm_pagepool_alloc: allocate `count` pages as one zeroed, locked region, and store
+ *                          the bus address of each page in `baddrs`. The frames are read
+ *                          from `pagemap` (normally /proc/self/pagemap). Returns the
+ *                          region, or NULL (printing why) on failure. */
+void *jackpifm_pagepool_alloc(size_t count, uint32_t *baddrs, const char *pagemap);
+
+/* jackpifm_pagepool_release: unlock and free a region returned by jackpifm_pagepool_alloc */
+void jackpifm_pagepool_release(void *region, size_t count);
+
+/* jackpifm_pagepool_resolve: store in `baddrs` the bus addresses of the `count` pages
+ *                            starting at `vaddr`, in a single read of `pagemap`.
+ *                            Returns 0, or -1 (printing why) if any page isn't present. */
+int jackpifm_pagepool_resolve(const char *pagemap, const void *vaddr, size_t count, uint32_t *baddrs);
+
+/* jackpifm_pagepool_decode: store in `baddrs` the bus addresses from `count` pagemap
+ *                           `entries`, as read by jackpifm_pagepool_resolve. Returns 0,
+ *                           or -1 (printing why) if any page isn't present. */
+int jackpifm_pagepool_decode(const uint64_t *entries, size_t count, uint32_t *baddrs);
+
+
+typedef struct jackpifm_pagetable_t jackpifm_pagetable_t;
+
+/* jackpifm_pagetable_new: create a lookup table from the bus addresses of `count` pages
+ *                         (as filled by jackpifm_pagepool_alloc) back to their indices.
+ *                         `baddrs` is used by the table, and must outlive it. */
+jackpifm_pagetable_t *jackpifm_pagetable_new(const uint32_t *baddrs, size_t count) __attribute__((malloc));
+
+/* jackpifm_pagetable_find: index of the page containing bus address `addr`, or -1.
+ *                          Takes constant time. */
+long jackpifm_pagetable_find(const jackpifm_pagetable_t *table, uint32_t addr);
+
+/* jackpifm_pagetable_free: deallocate a lookup table */
+void jackpifm_pagetable_free(jackpifm_pagetable_t *table);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JACKPIFM_PAGEPOOL_H */
@@ -0,0 +1,167 @@
+#include "pipeline.h"
+
+#include <math.h>
+#include <assert.h>
+
+#include "limiter.h"
+#include "preemp.h"
+#include "resamp.h"
+#include "mpx.h"
+
+struct jackpifm_pipeline_t {
+  size_t channels;
+  double ratio;       /* nominal resampling ratio, jrate/rate */
+  double max_factor;
+  bool preemp_mpx;    /* pre-emphasis and the second limiter run after resampling */
+  bool clipper;
+
+  /* Filters (NULL if disabled) */
+  jackpifm_limiter_t *limiter;      /* keeps the input in range */
+  jackpifm_preemp_t *preemp;        /* both channels at once */
+  jackpifm_limiter_t *post_limiter; /* catches the peaks pre-emphasis adds */
+  jackpifm_resamp_t *resampler[2];
+  jackpifm_mpx_t *mpx;
+
+  /* Tile buffers */
+  jackpifm_sample_t *tile[2];    /* JACKPIFM_PIPELINE_TILE input frames */
+  jackpifm_sample_t *rtile[2];   /* resampled tile */
+};
+
+jackpifm_pipeline_t *jackpifm_pipeline_new(const jackpifm_pipeline_config_t *config) {
+  jackpifm_pipeline_t *pipeline = jackpifm_calloc(1, sizeof(jackpifm_pipeline_t));
+  size_t channels = config->channels;
+  bool resample = config->rate != config->jrate;
+  assert(channels == 1 || channels == 2);
+  assert(resample || (channels == 1 && !config->rds_data));
+
+  pipeline->channels = channels;
+  pipeline->ratio = config->jrate / config->rate;
+  pipeline->max_factor = config->max_factor > 1 ? config->max_factor : 1;
+  pipeline->preemp_mpx = config->preemp_mpx && resample;
+  pipeline->clipper = config->clipper;
+  pipeline->limiter = jackpifm_limiter_new(channels, config->jrate, 1, config->lookahead, config->release);
+  if (config->preemp) {
+    double rate = pipeline->preemp_mpx ? config->rate : config->jrate;
+    pipeline->preemp = jackpifm_preemp_new(channels, rate, config->preemp_tau);
+    pipeline->post_limiter = jackpifm_limiter_new(channels, rate, 1, config->lookahead, config->release);
+  }
+  for (size_t c = 0; c < channels; c++) {
+    pipeline->tile[c] = jackpifm_calloc(JACKPIFM_PIPELINE_TILE, sizeof(jackpifm_sample_t));
+
+    if (resample) {
+      size_t rsize = ceil(JACKPIFM_PIPELINE_TILE * pipeline->max_factor / pipeline->ratio) + 2;
+      pipeline->resampler[c] = jackpifm_resamp_new(pipeline->ratio, config->resamp_quality, config->resamp_squality);
+      pipeline->rtile[c] = jackpifm_calloc(rsize, sizeof(jackpifm_sample_t));
+    }
+  }
+
+  if (channels == 2 || config->rds_data) {
+    jackpifm_mpx_config_t mpx_config = {
+      channels == 2,
+      (channels == 2) ? (1 - config->pilot_level) / 2 : 1,
+      config->pilot_level, config->rds_level,
+      config->rds_data, config->rds_size,
+    };
+    pipeline->mpx = jackpifm_mpx_new(&mpx_config);
+  }
+
+  return pipeline;
+}
+
+void jackpifm_pipeline_set_factor(jackpifm_pipeline_t *pipeline, double factor) {
+  if (factor > pipeline->max_factor) factor = pipeline->max_factor;
+  for (size_t c = 0; c < pipeline->channels; c++)
+    if (pipeline->resampler[c])
+      jackpifm_resamp_set_ratio(pipeline->resampler[c], pipeline->ratio / factor);
+}
+
+size_t jackpifm_pipeline_delay(const jackpifm_pipeline_t *pipeline) {
+  size_t delay = jackpifm_limiter_delay(pipeline->limiter);
+  if (pipeline->post_limiter) {
+    size_t post = jackpifm_limiter_delay(pipeline->post_limiter);
+    delay += pipeline->preemp_mpx ? round(post * pipeline->ratio) : post;
+  }
+  return delay;
+}
+
+size_t jackpifm_pipeline_count(const jackpifm_pipeline_t *pipeline, size_t size) {
+  if (!pipeline->resampler[0]) return size;
+  return jackpifm_resamp_count(pipeline->resampler[0], size);
+}
+
+static inline void clip_tile(jackpifm_sample_t *data, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    jackpifm_sample_t sample = data[i];
+    data[i] = (sample < -1) ? -1 : (sample > +1) ? +1 : sample;
+  }
+}
+
+size_t jackpifm_pipeline_process(jackpifm_pipeline_t *pipeline, jackpifm_sample_t *const *in, size_t size,
+                                 jackpifm_sample_t *out, float *reduction) {
+  size_t channels = pipeline->channels;
+  size_t total = 0;
+
+  for (size_t offset = 0; offset < size; offset += JACKPIFM_PIPELINE_TILE) {
+    size_t n = size - offset;
+    if (n > JACKPIFM_PIPELINE_TILE) n = JACKPIFM_PIPELINE_TILE;
+
+    /* Limit, pre-emphasize and limit again */
+    for (size_t c = 0; c < channels; c++)
+      memcpy(pipeline->tile[c], in[c] + offset, n * sizeof(jackpifm_sample_t));
+    jackpifm_limiter_process(pipeline->limiter, pipeline->tile, n, reduction);
+    if (pipeline->preemp && !pipeline->preemp_mpx) {
+      jackpifm_preemp_process(pipeline->preemp, pipeline->tile, n);
+      jackpifm_limiter_process(pipeline->post_limiter, pipeline->tile, n, reduction);
+    }
+
+    /* The last stage writes to the output (or to a tile, if discarding) */
+    jackpifm_sample_t *dest = out ? out + total : pipeline->resampler[0] ? pipeline->rtile[0] : pipeline->tile[0];
+
+    /* Resample */
+    size_t count = n;
+    if (pipeline->resampler[0]) {
+      jackpifm_sample_t *resampled[2];
+      for (size_t c = 0; c < channels; c++) {
+        resampled[c] = (c == 0 && !pipeline->mpx) ? dest : pipeline->rtile[c];
+        size_t result = jackpifm_resamp_process(pipeline->resampler[c], resampled[c], pipeline->tile[c], n);
+        /* Both resamplers are fed the same samples, so they always output the same count */
+        assert(c == 0 || result == count);
+        count = result;
+      }
+
+      /* Or pre-emphasize and limit now, at the output rate */
+      if (pipeline->preemp_mpx && pipeline->preemp) {
+        jackpifm_preemp_process(pipeline->preemp, resampled, count);
+        jackpifm_limiter_process(pipeline->post_limiter, resampled, count, reduction);
+      }
+    } else if (dest != pipeline->tile[0]) {
+      memcpy(dest, pipeline->tile[0], n * sizeof(jackpifm_sample_t));
+    }
+
+    /* Stereo modulate and RDS encode */
+    if (pipeline->mpx)
+      jackpifm_mpx_process(pipeline->mpx, dest, pipeline->rtile[0], pipeline->rtile[1], count);
+
+    /* The pilot and RDS ride on top of the limited audio, so the composite may still overshoot */
+    if (pipeline->clipper)
+      clip_tile(dest, count);
+
+    total += count;
+  }
+
+  return total;
+}
+
+void jackpifm_pipeline_free(jackpifm_pipeline_t *pipeline) {
+  if (!pipeline) return;
+  jackpifm_preemp_free(pipeline->preemp);
+  for (size_t c = 0; c < pipeline->channels; c++) {
+    jackpifm_resamp_free(pipeline->resampler[c]);
+    free(pipeline->tile[c]);
+    free(pipeline->rtile[c]);
+  }
+  jackpifm_limiter_free(pipeline->limiter);
+  jackpifm_limiter_free(pipeline->post_limiter);
+  jackpifm_mpx_free(pipeline->mpx);
+  free(pipeline);
+}
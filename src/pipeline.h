@@ -0,0 +1,69 @@
+/* pipeline.h - runs the whole DSP chain over small tiles in a single pass */
+
+#ifndef JACKPIFM_PIPELINE_H
+#define JACKPIFM_PIPELINE_H
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Input frames processed per tile; sized so that a tile and its resampled
+ * output (for every channel) stay in L1 cache through the whole chain. */
+#define JACKPIFM_PIPELINE_TILE 128
+
+typedef struct jackpifm_pipeline_t jackpifm_pipeline_t;
+
+typedef struct {
+  size_t channels;          /* 1, or 2 for stereo */
+  double jrate;             /* input sample rate */
+  double rate;              /* output sample rate, resampling is done if it differs */
+  bool preemp;              /* apply pre-emphasis */
+  double preemp_tau;        /* its time constant, in seconds */
+  bool preemp_mpx;          /* apply it after resampling, at the output rate */
+  size_t resamp_quality;
+  size_t resamp_squality;
+  const uint8_t *rds_data;  /* RDS blob to encode, or NULL */
+  size_t rds_size;
+  float pilot_level;        /* stereo pilot amplitude, the audio takes the rest */
+  float rds_level;          /* RDS subcarrier amplitude */
+  double max_factor;        /* largest factor passed to jackpifm_pipeline_set_factor (1 if unused) */
+  double lookahead;         /* look-ahead of the limiters, in seconds (they delay the signal by as much) */
+  double release;           /* release time constant of the limiters, in seconds */
+  bool clipper;             /* clip the composite signal to full deviation, as a last resort */
+} jackpifm_pipeline_config_t;
+
+/* jackpifm_pipeline_new: create the filters for a pipeline (stereo and RDS need resampling) */
+jackpifm_pipeline_t *jackpifm_pipeline_new(const jackpifm_pipeline_config_t *config) __attribute__((malloc));
+
+/* jackpifm_pipeline_set_factor: scale the output rate by `factor` (clamped to max_factor),
+ *                               to absorb clock drift when resampling. Takes effect from the
+ *                               next sample, so call it before jackpifm_pipeline_count. */
+void jackpifm_pipeline_set_factor(jackpifm_pipeline_t *pipeline, double factor);
+
+/* jackpifm_pipeline_delay: input frames the signal is held back by (the limiters' look-ahead) */
+size_t jackpifm_pipeline_delay(const jackpifm_pipeline_t *pipeline);
+
+/* jackpifm_pipeline_count: number of samples that processing `size` frames would output right now */
+size_t jackpifm_pipeline_count(const jackpifm_pipeline_t *pipeline, size_t size);
+
+/* jackpifm_pipeline_process: limit, pre-emphasize, limit again, resample and compose the MPX
+ *                            signal from `size` frames of each channel (with `preemp_mpx`,
+ *                            pre-emphasis and the second limiter run after resampling),
+ *                            writing the result straight to `out`, which must fit
+ *                            jackpifm_pipeline_count(size) samples (if NULL, it's discarded
+ *                            but the filters still advance). Input buffers aren't modified.
+ *                            Returns the number of output samples; if the limiters reduced
+ *                            the gain by more than `*reduction` dB, it's set to that. */
+size_t jackpifm_pipeline_process(jackpifm_pipeline_t *pipeline, jackpifm_sample_t *const *in, size_t size,
+                                 jackpifm_sample_t *out, float *reduction);
+
+/* jackpifm_pipeline_free: deallocate a pipeline and its filters */
+void jackpifm_pipeline_free(jackpifm_pipeline_t *pipeline);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JACKPIFM_PIPELINE_H */
@@ -1,31 +1,115 @@
 #include "preemp.h"
 
-/* This isn't the right filter, but it's close...
- * TODO something with a bilinear transform not being right... */
+#include <math.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PREEMP_NEON
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#define PREEMP_SSE
+#endif
+
+#define PI 3.14159265358979323846
+
+/* The response is matched to the analog one up to here (or 0.45 of the sample rate) */
+#define PREEMP_TOP 15000.0
+
+/* The analog pre-emphasis is 1 + s*tau, which keeps rising forever. It's turned
+ * into a high shelf with the bilinear transform: the zero is pre-warped to the
+ * 1/(2 pi tau) corner, and a pole is added where the shelf's gain at PREEMP_TOP
+ * matches the analog curve's, cancelling the warping there. Up to PREEMP_TOP
+ * the response stays within 0.15dB of the analog one at 44.1kHz and above.
+ *
+ * y[n] = b0 x[n] + b1 x[n-1] - a1 y[n-1], with both channels run in SIMD lanes. */
 
 struct jackpifm_preemp_t {
-  jackpifm_sample_t last_sample;
-  double fm_constant;
+  size_t channels;
+  float b0, b1, a1;
+  float last_in[2], last_out[2];
 };
 
-jackpifm_preemp_t *jackpifm_preemp_new(double sample_rate) {
-  jackpifm_preemp_t *filter = jackpifm_malloc(sizeof(jackpifm_preemp_t));
-  filter->last_sample = 0;
-  filter->fm_constant = sample_rate * 75.0e-6;  /* 75µs time constant */
+jackpifm_preemp_t *jackpifm_preemp_new(size_t channels, double sample_rate, double tau) {
+  jackpifm_preemp_t *filter = jackpifm_calloc(1, sizeof(jackpifm_preemp_t));
+  filter->channels = channels;
+
+  double corner = 1 / (2*PI*tau);
+  double top = (PREEMP_TOP < 0.45 * sample_rate) ? PREEMP_TOP : 0.45 * sample_rate;
+  double wz = tan(PI * corner / sample_rate);
+  double wt = tan(PI * top / sample_rate);
+  double warped = hypot(1, wt / wz) / hypot(1, top / corner);  /* always > 1 */
+  double wp = wt / sqrt(warped*warped - 1);
+
+  filter->b0 = (1 + 1/wz) / (1 + 1/wp);
+  filter->b1 = (1 - 1/wz) / (1 + 1/wp);
+  filter->a1 = (1 - 1/wp) / (1 + 1/wp);
   return filter;
 }
 
-void jackpifm_preemp_process(jackpifm_preemp_t *filter, jackpifm_sample_t *data, size_t size) {
-  jackpifm_sample_t last_sample = filter->last_sample;
-  double coeff = 1 - filter->fm_constant;  /* fir of 1 + s tau */
+static void preemp_stereo(jackpifm_preemp_t *filter, jackpifm_sample_t *left, jackpifm_sample_t *right, size_t size) {
+#if defined(PREEMP_NEON)
+  float32x2_t b0 = vdup_n_f32(filter->b0), b1 = vdup_n_f32(filter->b1), a1 = vdup_n_f32(filter->a1);
+  float32x2_t x1 = vld1_f32(filter->last_in), y1 = vld1_f32(filter->last_out);
+  for (size_t i = 0; i < size; i++) {
+    float32x2_t x = vld1_lane_f32(right + i, vld1_dup_f32(left + i), 1);
+    float32x2_t y = vmls_f32(vmla_f32(vmul_f32(x, b0), x1, b1), y1, a1);
+    vst1_lane_f32(left + i, y, 0);
+    vst1_lane_f32(right + i, y, 1);
+    x1 = x;
+    y1 = y;
+  }
+  vst1_f32(filter->last_in, x1);
+  vst1_f32(filter->last_out, y1);
+#elif defined(PREEMP_SSE)
+  __m128 b0 = _mm_set1_ps(filter->b0), b1 = _mm_set1_ps(filter->b1), a1 = _mm_set1_ps(filter->a1);
+  __m128 x1 = _mm_setr_ps(filter->last_in[0], filter->last_in[1], 0, 0);
+  __m128 y1 = _mm_setr_ps(filter->last_out[0], filter->last_out[1], 0, 0);
+  for (size_t i = 0; i < size; i++) {
+    __m128 x = _mm_unpacklo_ps(_mm_load_ss(left + i), _mm_load_ss(right + i));
+    __m128 y = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(x, b0), _mm_mul_ps(x1, b1)), _mm_mul_ps(y1, a1));
+    _mm_store_ss(left + i, y);
+    _mm_store_ss(right + i, _mm_shuffle_ps(y, y, 1));
+    x1 = x;
+    y1 = y;
+  }
+  _mm_storel_pi((__m64 *)filter->last_in, x1);
+  _mm_storel_pi((__m64 *)filter->last_out, y1);
+#else
+  float b0 = filter->b0, b1 = filter->b1, a1 = filter->a1;
+  float xl = filter->last_in[0], xr = filter->last_in[1];
+  float yl = filter->last_out[0], yr = filter->last_out[1];
+  for (size_t i = 0; i < size; i++) {
+    float l = left[i], r = right[i];
+    yl = b0 * l + b1 * xl - a1 * yl;
+    yr = b0 * r + b1 * xr - a1 * yr;
+    left[i] = yl;
+    right[i] = yr;
+    xl = l;
+    xr = r;
+  }
+  filter->last_in[0] = xl;
+  filter->last_in[1] = xr;
+  filter->last_out[0] = yl;
+  filter->last_out[1] = yr;
+#endif
+}
 
+static void preemp_mono(jackpifm_preemp_t *filter, jackpifm_sample_t *data, size_t size) {
+  float b0 = filter->b0, b1 = filter->b1, a1 = filter->a1;
+  float x1 = filter->last_in[0], y1 = filter->last_out[0];
   for (size_t i = 0; i < size; i++) {
-    float sample = data[i];
-    data[i] += (last_sample - sample) / coeff;
-    last_sample = sample;
+    float x = data[i];
+    y1 = b0 * x + b1 * x1 - a1 * y1;
+    data[i] = y1;
+    x1 = x;
   }
+  filter->last_in[0] = x1;
+  filter->last_out[0] = y1;
+}
 
-  filter->last_sample = last_sample;
+void jackpifm_preemp_process(jackpifm_preemp_t *filter, jackpifm_sample_t *const *data, size_t size) {
+  if (filter->channels == 2) preemp_stereo(filter, data[0], data[1], size);
+  else preemp_mono(filter, data[0], size);
 }
 
 void jackpifm_preemp_free(jackpifm_preemp_t *filter) {
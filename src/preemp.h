@@ -11,11 +11,12 @@ extern "C" {
 
 typedef struct jackpifm_preemp_t jackpifm_preemp_t;
 
-/* jackpifm_preemp_new: create new preemp filter object */
-jackpifm_preemp_t *jackpifm_preemp_new(double sample_rate) __attribute__((malloc));
+/* jackpifm_preemp_new: create new preemp filter object for `channels` (1 or 2), with a
+ *                      time constant of `tau` seconds (50us in Europe, 75us in the Americas) */
+jackpifm_preemp_t *jackpifm_preemp_new(size_t channels, double sample_rate, double tau) __attribute__((malloc));
 
-/* jackpifm_preemp_process: process samples using a filter object */
-void jackpifm_preemp_process(jackpifm_preemp_t *filter, jackpifm_sample_t *data, size_t size);
+/* jackpifm_preemp_process: process `size` samples of each channel in place */
+void jackpifm_preemp_process(jackpifm_preemp_t *filter, jackpifm_sample_t *const *data, size_t size);
 
 /* jackpifm_preemp_free: deallocate a preemp filter object */
 void jackpifm_preemp_free(jackpifm_preemp_t *filter);
@@ -1,29 +1,47 @@
 #include "rds.h"
 
-#include <math.h>
-
-#define PI 3.14159265358979323846
 #define EXTRACT_BIT(byte, n) ((byte) >> (7-(n))) & 1
 
+#define BIT_SAMPLES JACKPIFM_RDS_BIT_SAMPLES
+
 struct jackpifm_rds_t {
-  jackpifm_sample_t current_sample;
   bool current_bit;
-  int state;
   int bit_num;
-  double sin[8];
+
+  /* Waveform for a bit, indexed by (previous bit << 1 | current bit):
+   * manchester symbol shaped by the IIR */
+  jackpifm_sample_t symbols[4][BIT_SAMPLES];
 
   uint8_t *rds_data;
   size_t rds_size;
 };
 
+/* The shaping is a very simple IIR filter, to hopefully reduce sidebands. Its
+ * state at the start of a bit only depends noticeably on the previous one (the
+ * bit before that has decayed by 0.99^384), so it's computed from a steady run of
+ * previous bits and the waveform tabulated. */
+static void build_symbol(jackpifm_sample_t *symbol, bool previous_bit, bool current_bit) {
+  double current_sample = 0;
+
+  for (size_t run = 0; run < 8; run++)
+    for (int state = 0; state < BIT_SAMPLES; state++) {
+      bool output_bit = (state < BIT_SAMPLES/2) ? previous_bit : !previous_bit;  /* manchester encoding */
+      current_sample = 0.99 * current_sample + 0.01 * (output_bit ? +1 : -1);
+    }
+
+  for (int state = 0; state < BIT_SAMPLES; state++) {
+    bool output_bit = (state < BIT_SAMPLES/2) ? current_bit : !current_bit;
+    current_sample = 0.99 * current_sample + 0.01 * (output_bit ? +1 : -1);
+    symbol[state] = current_sample;
+  }
+}
+
 jackpifm_rds_t *jackpifm_rds_new(const uint8_t *rds_data, size_t rds_size) {
   jackpifm_rds_t *filter = jackpifm_malloc(sizeof(jackpifm_rds_t));
-  filter->current_sample = 0;
   filter->current_bit = 0;
-  filter->state = 0;
   filter->bit_num = 0;
-  for (size_t i = 0; i < 8; i++)
-    filter->sin[i] = sin(i * 2*PI*3/8);
+  for (size_t i = 0; i < 4; i++)
+    build_symbol(filter->symbols[i], i >> 1, i & 1);
 
   filter->rds_data = jackpifm_malloc(rds_size);
   filter->rds_size = rds_size;
@@ -31,32 +49,15 @@ jackpifm_rds_t *jackpifm_rds_new(const uint8_t *rds_data, size_t rds_size) {
   return filter;
 }
 
-void jackpifm_rds_process(jackpifm_rds_t *filter, jackpifm_sample_t *data, size_t size) {
-  int state = filter->state;
-  jackpifm_sample_t current_sample = filter->current_sample;
-  bool current_bit = filter->current_bit;
-
-  for (size_t i = 0; i < size; i++) {
-    if (state == 0) {
-      /* get the next bit */
-      uint8_t new_byte = filter->rds_data[filter->bit_num / 8];
-      bool new_bit = EXTRACT_BIT(new_byte, filter->bit_num % 8);
-      filter->bit_num = (filter->bit_num+1) % (filter->rds_size * 8);
-
-      current_bit ^= new_bit;  /* differential encoding */
-    }
-
-    bool output_bit = (state < 384/2) ? current_bit : !current_bit;  /* manchester encoding */
-    /* very simple IIR filter to hopefully reduce sidebands */
-    current_sample = 0.99 * current_sample + 0.01 * (output_bit ? +1 : -1);
-
-    data[i] += 0.05 * current_sample * filter->sin[state%8];
-    state = (state+1) % 384;
-  }
+const jackpifm_sample_t *jackpifm_rds_symbol(jackpifm_rds_t *filter) {
+  /* get the next bit */
+  uint8_t new_byte = filter->rds_data[filter->bit_num / 8];
+  bool new_bit = EXTRACT_BIT(new_byte, filter->bit_num % 8);
+  filter->bit_num = (filter->bit_num+1) % (filter->rds_size * 8);
 
-  filter->state = state;
-  filter->current_sample = current_sample;
-  filter->current_bit = current_bit;
+  bool previous_bit = filter->current_bit;
+  filter->current_bit ^= new_bit;  /* differential encoding */
+  return filter->symbols[previous_bit << 1 | filter->current_bit];
 }
 
 void jackpifm_rds_free(jackpifm_rds_t *filter) {
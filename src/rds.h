@@ -1,4 +1,4 @@
-/* rds.h - encodes a chunk of RDS data into a 152kHz signal */
+/* rds.h - encodes a chunk of RDS data into a 152kHz baseband signal */
 
 #ifndef JACKPIFM_RDS_H
 #define JACKPIFM_RDS_H
@@ -9,13 +9,19 @@
 extern "C" {
 #endif
 
+/* Samples per bit at 152kHz. It's a multiple of the 19kHz pilot period (8 samples),
+ * so every bit starts at the same phase of the carriers. */
+#define JACKPIFM_RDS_BIT_SAMPLES 384
+
 typedef struct jackpifm_rds_t jackpifm_rds_t;
 
 /* jackpifm_rds_new: create new RDS filter object */
 jackpifm_rds_t *jackpifm_rds_new(const uint8_t *rds_data, size_t rds_size) __attribute__((malloc));
 
-/* jackpifm_rds_process: process samples at 152kHz using the filter */
-void jackpifm_rds_process(jackpifm_rds_t *filter, jackpifm_sample_t *data, size_t size);
+/* jackpifm_rds_symbol: encode the next bit, returning its shaped biphase waveform
+ *                     (JACKPIFM_RDS_BIT_SAMPLES samples in [-1, +1], to be multiplied
+ *                     by the 57kHz subcarrier). It stays valid until the filter is freed. */
+const jackpifm_sample_t *jackpifm_rds_symbol(jackpifm_rds_t *filter);
 
 /* jackpifm_rds_free: deallocate an RDS filter object */
 void jackpifm_rds_free(jackpifm_rds_t *filter);
@@ -2,77 +2,147 @@
 
 #include <math.h>
 
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define RESAMP_NEON
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#define RESAMP_SSE
+#endif
+
 #define PI 3.14159265358979323846
 
+/* The tap loop works on groups of this many samples */
+#define RESAMP_LANES 4
+
 struct jackpifm_resamp_t {
   /* Static parameters */
-  float ratio;
+  double ratio;  /* (double, so --sync=resamp steps of 0.1ppm aren't lost) */
   size_t quality;
   size_t squality;
+  size_t taps;  /* quality, rounded up to RESAMP_LANES (extra taps are zero) */
+
+  /* Polyphase tables: squality+1 rows of `taps` coefficients,
+   * and the difference between each row and the next one */
+  jackpifm_sample_t *coeffs;
+  jackpifm_sample_t *deltas;
 
-  /* Lookup tables */
-  jackpifm_sample_t **sinc_lut;
-  
   /* Variables */
-  jackpifm_sample_t *sample_data;
-  float free_time;
+  jackpifm_sample_t *history;  /* double-length ring, so the last `taps` samples are contiguous */
+  size_t hpos;
+  double free_time;
 };
 
-jackpifm_resamp_t *jackpifm_resamp_new(float ratio, size_t quality, size_t squality) {
+jackpifm_resamp_t *jackpifm_resamp_new(double ratio, size_t quality, size_t squality) {
   jackpifm_resamp_t *filter = jackpifm_malloc(sizeof(jackpifm_resamp_t));
+  size_t taps = (quality + RESAMP_LANES-1) / RESAMP_LANES * RESAMP_LANES;
+  size_t pad = taps - quality;
+
   filter->ratio = ratio;
   filter->quality = quality;
   filter->squality = squality;
-  filter->sample_data = jackpifm_calloc(quality, sizeof(jackpifm_sample_t));
+  filter->taps = taps;
+  filter->history = jackpifm_calloc(2 * taps, sizeof(jackpifm_sample_t));
+  filter->hpos = 0;
   filter->free_time = 1;
 
-  filter->sinc_lut = jackpifm_calloc(squality, sizeof(jackpifm_sample_t *));
-  for (size_t lut_num = 0; lut_num < squality; lut_num++) {
-    filter->sinc_lut[lut_num] = jackpifm_calloc(quality, sizeof(jackpifm_sample_t));
+  /* One extra row for phase 1.0, so that every phase can be interpolated */
+  filter->coeffs = jackpifm_calloc((squality+1) * taps, sizeof(jackpifm_sample_t));
+  filter->deltas = jackpifm_calloc(squality * taps, sizeof(jackpifm_sample_t));
+  for (size_t lut_num = 0; lut_num <= squality; lut_num++) {
+    jackpifm_sample_t *row = filter->coeffs + lut_num * taps + pad;
     for (size_t sample_num = 0; sample_num < quality; sample_num++) {
       float x = (quality-1)/2.0 + lut_num/(float)squality - sample_num;
-      filter->sinc_lut[lut_num][sample_num] = (x == 0) ? 1 : sinf(x)/x;
+      row[sample_num] = (x == 0) ? 1 : sinf(x)/x;
     }
   }
+  for (size_t i = 0; i < squality * taps; i++)
+    filter->deltas[i] = filter->coeffs[i + taps] - filter->coeffs[i];
 
   return filter;
 }
 
+/* Dot product of `x` against the taps interpolated between `c` and `c + d` */
+static inline float resamp_dot(const jackpifm_sample_t *x, const jackpifm_sample_t *c, const jackpifm_sample_t *d, float frac, size_t taps) {
+#if defined(RESAMP_NEON)
+  float32x4_t acc = vdupq_n_f32(0);
+  for (size_t s = 0; s < taps; s += 4) {
+    float32x4_t tap = vmlaq_n_f32(vld1q_f32(c + s), vld1q_f32(d + s), frac);
+    acc = vmlaq_f32(acc, vld1q_f32(x + s), tap);
+  }
+  float32x2_t sum = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+  return vget_lane_f32(vpadd_f32(sum, sum), 0);
+#elif defined(RESAMP_SSE)
+  __m128 acc = _mm_setzero_ps(), f = _mm_set1_ps(frac);
+  for (size_t s = 0; s < taps; s += 4) {
+    __m128 tap = _mm_add_ps(_mm_loadu_ps(c + s), _mm_mul_ps(_mm_loadu_ps(d + s), f));
+    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(x + s), tap));
+  }
+  acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+  acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+  return _mm_cvtss_f32(acc);
+#else
+  float acc[RESAMP_LANES] = {0};
+  for (size_t s = 0; s < taps; s += RESAMP_LANES)
+    for (size_t l = 0; l < RESAMP_LANES; l++)
+      acc[l] += x[s+l] * (c[s+l] + d[s+l] * frac);
+  return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+#endif
+}
+
 size_t jackpifm_resamp_process(jackpifm_resamp_t *filter, jackpifm_sample_t *out, const jackpifm_sample_t *data, size_t size) {
-  size_t quality = filter->quality, squality = filter->squality;
-  jackpifm_sample_t *sample_data = filter->sample_data;
-  float free_time = filter->free_time, ratio = filter->ratio;
+  size_t taps = filter->taps, squality = filter->squality;
+  jackpifm_sample_t *history = filter->history;
+  size_t hpos = filter->hpos;
+  double free_time = filter->free_time, ratio = filter->ratio;
   size_t o = 0;
 
   for (size_t i = 0; i < size; i++) {
-    /* Shift old samples to the left */
-    for (size_t s = 0; s < quality; s++)
-      sample_data[s] = sample_data[s+1];
-
-    /* Insert sample at the end */
-    sample_data[quality-1] = data[i];
+    /* Insert sample at the end (in both halves of the ring) */
+    history[hpos] = history[hpos + taps] = data[i];
+    hpos = (hpos+1 == taps) ? 0 : hpos+1;
     free_time -= 1;
 
-    /* Output resampled samples */
+    /* Output resampled samples; the window goes from oldest to newest */
+    const jackpifm_sample_t *window = history + hpos;
     while (free_time < 1) {
-      float out_sample = 0;
-      jackpifm_sample_t *lut = filter->sinc_lut[(int)(free_time*squality)];
-      for (size_t s = 0; s < quality; s++)
-        out_sample += sample_data[s] * lut[s];
-      out[o++] = out_sample;
+      float phase = free_time * squality;
+      size_t row = (size_t)phase;
+      out[o++] = resamp_dot(window, filter->coeffs + row * taps, filter->deltas + row * taps, phase - row, taps);
       free_time += ratio;
     }
   }
 
+  filter->hpos = hpos;
   filter->free_time = free_time;
   return o;
 }
 
+void jackpifm_resamp_set_ratio(jackpifm_resamp_t *filter, double ratio) {
+  /* free_time is the position of the next output sample, so it's left as is */
+  filter->ratio = ratio;
+}
+
+size_t jackpifm_resamp_count(const jackpifm_resamp_t *filter, size_t size) {
+  double free_time = filter->free_time, ratio = filter->ratio;
+  size_t o = 0;
+
+  /* Same arithmetic as jackpifm_resamp_process, so the result is exact */
+  for (size_t i = 0; i < size; i++) {
+    free_time -= 1;
+    while (free_time < 1) {
+      o++;
+      free_time += ratio;
+    }
+  }
+
+  return o;
+}
+
 void jackpifm_resamp_free(jackpifm_resamp_t *filter) {
   if (!filter) return;
-  for (size_t lut_num = 0; lut_num < filter->squality; lut_num++)
-    free(filter->sinc_lut[lut_num]);
-  free(filter->sinc_lut);
-  free(filter->sample_data);
+  free(filter->coeffs);
+  free(filter->deltas);
+  free(filter->history);
   free(filter);
 }
@@ -12,11 +12,18 @@ extern "C" {
 typedef struct jackpifm_resamp_t jackpifm_resamp_t;
 
 /* jackpifm_resamp_new: create new resamp filter object */
-jackpifm_resamp_t *jackpifm_resamp_new(float ratio, size_t quality, size_t squality) __attribute__((malloc));
+jackpifm_resamp_t *jackpifm_resamp_new(double ratio, size_t quality, size_t squality) __attribute__((malloc));
 
 /* jackpifm_resamp_process: process samples using a filter object */
 size_t jackpifm_resamp_process(jackpifm_resamp_t *filter, jackpifm_sample_t *out, const jackpifm_sample_t *data, size_t size);
 
+/* jackpifm_resamp_set_ratio: change the ratio (input samples per output sample) from
+ *                            the next output sample on, without discontinuities */
+void jackpifm_resamp_set_ratio(jackpifm_resamp_t *filter, double ratio);
+
+/* jackpifm_resamp_count: number of samples that processing `size` samples would output right now */
+size_t jackpifm_resamp_count(const jackpifm_resamp_t *filter, size_t size);
+
 /* jackpifm_resamp_free: deallocate a resamp filter object */
 void jackpifm_resamp_free(jackpifm_resamp_t *filter);
 
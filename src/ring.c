@@ -0,0 +1,116 @@
+#define _GNU_SOURCE
+#include "ring.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#define CACHE_LINE 64
+
+/* `ipos` and `opos` run freely (they're never wrapped) and are masked on access,
+ * so `ipos - opos` is always the fill level. Each one is only written by one side;
+ * the release store publishes the samples (or the free space) to the other side. */
+struct jackpifm_ring_t {
+  size_t ipos;  /* written by the producer */
+  char pad0[CACHE_LINE - sizeof(size_t)];
+  size_t opos;  /* written by the consumer */
+  char pad1[CACHE_LINE - sizeof(size_t)];
+
+  size_t size;
+  size_t mask;
+  jackpifm_sample_t *data;  /* `size` samples, then the same ones again */
+};
+
+/* Map a memfd of `bytes` twice, back to back */
+static void *map_mirrored(size_t bytes) {
+  int fd = memfd_create("jackpifm-ring", MFD_CLOEXEC);
+  if (fd < 0 || ftruncate(fd, bytes)) {
+    fprintf(stderr, "Couldn't create ringbuffer memory: %s\n", strerror(errno));
+    abort();
+  }
+
+  /* Reserve the whole range first, then put both views of the file over it */
+  uint8_t *base = mmap(NULL, 2 * bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED ||
+      mmap(base, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+      mmap(base + bytes, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+    fprintf(stderr, "Couldn't map ringbuffer memory: %s\n", strerror(errno));
+    abort();
+  }
+
+  close(fd);
+  return base;
+}
+
+jackpifm_ring_t *jackpifm_ring_new(size_t size) {
+  jackpifm_ring_t *ring = jackpifm_calloc(1, sizeof(jackpifm_ring_t));
+  size_t page_samples = sysconf(_SC_PAGESIZE) / sizeof(jackpifm_sample_t);
+  size_t real_size = 1;
+  while (real_size < size || real_size < page_samples) real_size <<= 1;
+
+  ring->size = real_size;
+  ring->mask = real_size - 1;
+  ring->data = map_mirrored(real_size * sizeof(jackpifm_sample_t));
+  ring->ipos = ring->opos = 0;
+  return ring;
+}
+
+size_t jackpifm_ring_size(const jackpifm_ring_t *ring) {
+  return ring->size;
+}
+
+size_t jackpifm_ring_fill(const jackpifm_ring_t *ring) {
+  size_t opos = __atomic_load_n(&ring->opos, __ATOMIC_ACQUIRE);
+  size_t ipos = __atomic_load_n(&ring->ipos, __ATOMIC_ACQUIRE);
+  return ipos - opos;
+}
+
+size_t jackpifm_ring_space(const jackpifm_ring_t *ring) {
+  return ring->size - jackpifm_ring_fill(ring);
+}
+
+jackpifm_sample_t *jackpifm_ring_write_begin(jackpifm_ring_t *ring, size_t size) {
+  size_t ipos = __atomic_load_n(&ring->ipos, __ATOMIC_RELAXED);
+  size_t opos = __atomic_load_n(&ring->opos, __ATOMIC_ACQUIRE);
+  if (ring->size - (ipos - opos) < size) return NULL;
+  return ring->data + (ipos & ring->mask);
+}
+
+void jackpifm_ring_write_commit(jackpifm_ring_t *ring, size_t size) {
+  size_t ipos = __atomic_load_n(&ring->ipos, __ATOMIC_RELAXED);
+  __atomic_store_n(&ring->ipos, ipos + size, __ATOMIC_RELEASE);
+}
+
+const jackpifm_sample_t *jackpifm_ring_read_begin(jackpifm_ring_t *ring, size_t size) {
+  size_t opos = __atomic_load_n(&ring->opos, __ATOMIC_RELAXED);
+  size_t ipos = __atomic_load_n(&ring->ipos, __ATOMIC_ACQUIRE);
+  if (ipos - opos < size) return NULL;
+  return ring->data + (opos & ring->mask);
+}
+
+void jackpifm_ring_read_commit(jackpifm_ring_t *ring, size_t size) {
+  size_t opos = __atomic_load_n(&ring->opos, __ATOMIC_RELAXED);
+  __atomic_store_n(&ring->opos, opos + size, __ATOMIC_RELEASE);
+}
+
+bool jackpifm_ring_write(jackpifm_ring_t *ring, const jackpifm_sample_t *data, size_t size) {
+  jackpifm_sample_t *window = jackpifm_ring_write_begin(ring, size);
+  if (!window) return false;
+  memcpy(window, data, size * sizeof(jackpifm_sample_t));
+  jackpifm_ring_write_commit(ring, size);
+  return true;
+}
+
+bool jackpifm_ring_read(jackpifm_ring_t *ring, jackpifm_sample_t *data, size_t size) {
+  const jackpifm_sample_t *window = jackpifm_ring_read_begin(ring, size);
+  if (!window) return false;
+  memcpy(data, window, size * sizeof(jackpifm_sample_t));
+  jackpifm_ring_read_commit(ring, size);
+  return true;
+}
+
+void jackpifm_ring_free(jackpifm_ring_t *ring) {
+  if (!ring) return;
+  munmap(ring->data, 2 * ring->size * sizeof(jackpifm_sample_t));
+  free(ring);
+}
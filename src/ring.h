@@ -0,0 +1,60 @@
+/* ring.h - wait-free single-producer / single-consumer sample ringbuffer
+ *
+ * The storage is mapped twice in a row, so any span of up to the ring's size is
+ * contiguous in memory; producers and consumers can work in place through the
+ * _begin / _commit pairs, without copies or split accesses at the wraparound. */
+
+#ifndef JACKPIFM_RING_H
+#define JACKPIFM_RING_H
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct jackpifm_ring_t jackpifm_ring_t;
+
+/* jackpifm_ring_new: create a ringbuffer of at least `size` samples (rounded up to a
+ *                    power of two, and to a whole page) */
+jackpifm_ring_t *jackpifm_ring_new(size_t size) __attribute__((malloc));
+
+/* jackpifm_ring_size: get the real size of the ringbuffer */
+size_t jackpifm_ring_size(const jackpifm_ring_t *ring);
+
+/* jackpifm_ring_fill: number of samples written but not read yet (safe from both sides) */
+size_t jackpifm_ring_fill(const jackpifm_ring_t *ring);
+
+/* jackpifm_ring_space: (producer) number of samples that can be written right now */
+size_t jackpifm_ring_space(const jackpifm_ring_t *ring);
+
+/* jackpifm_ring_write_begin: (producer) get the place to write the next `size` samples
+ *                            at, or NULL if they don't fit */
+jackpifm_sample_t *jackpifm_ring_write_begin(jackpifm_ring_t *ring, size_t size);
+
+/* jackpifm_ring_write_commit: (producer) publish `size` samples written in place */
+void jackpifm_ring_write_commit(jackpifm_ring_t *ring, size_t size);
+
+/* jackpifm_ring_read_begin: (consumer) get the next `size` samples in place, or NULL
+ *                           if there aren't that many. They stay valid until committed. */
+const jackpifm_sample_t *jackpifm_ring_read_begin(jackpifm_ring_t *ring, size_t size);
+
+/* jackpifm_ring_read_commit: (consumer) release `size` samples read in place */
+void jackpifm_ring_read_commit(jackpifm_ring_t *ring, size_t size);
+
+/* jackpifm_ring_write: (producer) append `size` samples; returns false,
+ *                      writing nothing, if they don't fit */
+bool jackpifm_ring_write(jackpifm_ring_t *ring, const jackpifm_sample_t *data, size_t size);
+
+/* jackpifm_ring_read: (consumer) take `size` samples; returns false,
+ *                     reading nothing, if there aren't that many */
+bool jackpifm_ring_read(jackpifm_ring_t *ring, jackpifm_sample_t *data, size_t size);
+
+/* jackpifm_ring_free: deallocate a ringbuffer */
+void jackpifm_ring_free(jackpifm_ring_t *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JACKPIFM_RING_H */
@@ -0,0 +1,222 @@
+#define _GNU_SOURCE
+#include "simdma.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+
+/* Fake bus addresses handed out for our pages */
+#define SIM_BUS_BASE 0x10000000
+#define SIM_PAGE_SIZE 4096
+
+/* Size of each mapped window of the dump file */
+#define SIM_CHUNK (16 * 1024 * 1024)
+
+#define TI_DREQ (1<<6)
+
+/* Pages, indexed by (bus address - SIM_BUS_BASE) / SIM_PAGE_SIZE */
+static void **pages = NULL;
+static size_t page_count = 0;
+
+/* Engine state */
+static bool running = false;
+static uint32_t current = 0;    // CONBLK_AD
+static double credit = 0;       // bytes the serializer can drain right now
+static double last_time = 0;    // modeled time of the last update, in seconds
+static uint64_t consumed = 0;
+static uint32_t first_block = 0;
+static bool lapped = false;       // the first lap (blocks nobody wrote yet) is over
+static uint64_t limit = UINT64_MAX;  // stop recording after this many blocks
+
+/* Clock */
+static double speed = 1;
+static double virtual_time = 0;
+static struct timespec start_time;
+
+/* Dump file */
+static int out_fd = -1;
+static char *out_map = NULL;
+static size_t out_offset = 0;  // file offset of the mapped window
+static size_t out_used = 0;    // bytes used in the mapped window
+
+static double sim_modeled_time(void) {
+  if (speed == 0) return virtual_time;
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  double elapsed = (now.tv_sec - start_time.tv_sec) + (now.tv_nsec - start_time.tv_nsec) / 1e9;
+  return elapsed * speed;
+}
+
+static struct CB *sim_lookup(uint32_t addr) {
+  size_t page = (addr - SIM_BUS_BASE) / SIM_PAGE_SIZE;
+  if (addr < SIM_BUS_BASE || page >= page_count || !pages[page]) {
+    fprintf(stderr, "Simulated DMA: bad control block address 0x%08x.\n", addr);
+    abort();
+  }
+  return (struct CB *)((char *)pages[page] + (addr % SIM_PAGE_SIZE));
+}
+
+static void sim_map_window(void) {
+  int ret = ftruncate(out_fd, out_offset + SIM_CHUNK);
+  if (ret) {
+    fprintf(stderr, "Simulated DMA: couldn't grow dump file: %s\n", strerror(errno));
+    abort();
+  }
+  out_map = mmap(NULL, SIM_CHUNK, PROT_READ|PROT_WRITE, MAP_SHARED, out_fd, out_offset);
+  if (out_map == MAP_FAILED) {
+    fprintf(stderr, "Simulated DMA: couldn't map dump file: %s\n", strerror(errno));
+    abort();
+  }
+  out_used = 0;
+}
+
+static void sim_record(const struct CB *cb) {
+  if (!lapped || consumed >= limit) return;
+  consumed++;
+  if (out_fd < 0) return;
+
+  if (out_used + sizeof(jackpifm_simdma_record_t) > SIM_CHUNK) {
+    munmap(out_map, SIM_CHUNK);
+    out_offset += SIM_CHUNK;
+    sim_map_window();
+  }
+
+  jackpifm_simdma_record_t *record = (jackpifm_simdma_record_t *)(out_map + out_used);
+  record->source_ad = cb->SOURCE_AD;
+  record->txfr_len = cb->TXFR_LEN;
+  out_used += sizeof(jackpifm_simdma_record_t);
+}
+
+/* Consume every control block the modeled clock allows since the last update.
+ * Blocks paced by the PWM (DREQ) cost TXFR_LEN bytes, the rest are free. */
+static void sim_advance(void) {
+  if (!running) return;
+
+  double now = sim_modeled_time();
+  credit += (now - last_time) * JACKPIFM_SIMDMA_BYTE_RATE;
+  last_time = now;
+
+  /* never spin more than one lap over the ring of free blocks */
+  size_t max_blocks = page_count * (SIM_PAGE_SIZE / sizeof(struct CB));
+  for (size_t n = 0; n < max_blocks; n++) {
+    struct CB *cb = sim_lookup(current);
+    double cost = (cb->TI & TI_DREQ) ? cb->TXFR_LEN : 0;
+    if (cost > credit) break;
+
+    credit -= cost;
+    sim_record(cb);
+    current = cb->NEXTCONBK;
+    if (current == first_block) lapped = true;
+  }
+}
+
+
+static void *sim_get_pages(size_t count, uint32_t *baddrs) {
+  void *region;
+  if (posix_memalign(&region, SIM_PAGE_SIZE, count * SIM_PAGE_SIZE)) {
+    fprintf(stderr, "Allocation failed.\n");
+    abort();
+  }
+  memset(region, 0, count * SIM_PAGE_SIZE);
+
+  pages = jackpifm_realloc(pages, (page_count + count) * sizeof(void *));
+  for (size_t i = 0; i < count; i++) {
+    pages[page_count] = (char *)region + i * SIM_PAGE_SIZE;
+    baddrs[i] = SIM_BUS_BASE + page_count * SIM_PAGE_SIZE;
+    page_count++;
+  }
+  return region;
+}
+
+static void sim_free_pages(void *region, size_t count) {
+  for (size_t i = 0; i < page_count; i++)
+    if (pages[i] == region) {
+      memset(pages + i, 0, count * sizeof(void *));
+      break;
+    }
+  free(region);
+}
+
+static void sim_start(uint32_t block) {
+  sim_lookup(block);
+  current = first_block = block;
+  lapped = false;
+  credit = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  virtual_time = 0;
+  last_time = 0;
+  running = true;
+}
+
+static void sim_stop(void) {
+  sim_advance();
+  running = false;
+}
+
+static uint32_t sim_current_block(void) {
+  sim_advance();
+  return current;
+}
+
+static void sim_now(struct timespec *time) {
+  if (speed == 0) {
+    time->tv_sec = (time_t)virtual_time;
+    time->tv_nsec = (long)((virtual_time - time->tv_sec) * 1e9);
+  } else clock_gettime(CLOCK_MONOTONIC, time);
+}
+
+static void sim_sleep_until(const struct timespec *deadline) {
+  if (speed == 0) {
+    double time = deadline->tv_sec + deadline->tv_nsec / 1e9;
+    if (time > virtual_time) virtual_time = time;
+  } else {
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL) == EINTR);
+  }
+}
+
+const jackpifm_dma_backend_t jackpifm_sim_dma = {
+  sim_get_pages,
+  sim_free_pages,
+  sim_start,
+  sim_stop,
+  sim_current_block,
+  sim_now,
+  sim_sleep_until,
+};
+
+
+int jackpifm_simdma_open(const char *path, double clock_speed) {
+  speed = clock_speed;
+  consumed = 0;
+  limit = UINT64_MAX;
+
+  if (!path) return 0;
+  out_fd = open(path, O_RDWR|O_CREAT|O_TRUNC, 0644);
+  if (out_fd < 0) {
+    fprintf(stderr, "Couldn't open '%s': %s\n", path, strerror(errno));
+    return 1;
+  }
+  out_offset = 0;
+  sim_map_window();
+  return 0;
+}
+
+void jackpifm_simdma_close() {
+  if (out_fd < 0) return;
+  munmap(out_map, SIM_CHUNK);
+  if (ftruncate(out_fd, out_offset + out_used))
+    fprintf(stderr, "Simulated DMA: couldn't trim dump file: %s\n", strerror(errno));
+  close(out_fd);
+  out_fd = -1;
+}
+
+void jackpifm_simdma_limit(uint64_t blocks) {
+  limit = blocks;
+}
+
+uint64_t jackpifm_simdma_consumed() {
+  return consumed;
+}
@@ -0,0 +1,49 @@
+/* simdma.h - simulated DMA engine, runs the outputter without hardware */
+
+#ifndef JACKPIFM_SIMDMA_H
+#define JACKPIFM_SIMDMA_H
+
+#include "common.h"
+#include "outputter.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Rate (in bytes per second) at which the PWM serializer drains delay control
+ * blocks; matches the timing constant used by the outputter. */
+#define JACKPIFM_SIMDMA_BYTE_RATE (22500.0 * 1373.5)
+
+/* One consumed control block, as written to the dump file */
+typedef struct {
+  uint32_t source_ad;
+  uint32_t txfr_len;
+} jackpifm_simdma_record_t;
+
+/* jackpifm_sim_dma: backend that consumes the control block ring in software.
+ *                   It must only be used from one thread at a time. */
+extern const jackpifm_dma_backend_t jackpifm_sim_dma;
+
+/* jackpifm_simdma_open: prepare the simulated engine. If `path` isn't NULL, every
+ *                       consumed control block is appended to that file, starting
+ *                       once the engine is back at its first block (the first lap
+ *                       only executes blocks nobody has written yet).
+ *                       `speed` scales the modeled clock against the wall clock;
+ *                       if zero, the clock is virtual and only advances while
+ *                       the outputter sleeps, so it runs as fast as the CPU allows. */
+int jackpifm_simdma_open(const char *path, double speed);
+
+/* jackpifm_simdma_close: flush and close the dump file */
+void jackpifm_simdma_close();
+
+/* jackpifm_simdma_limit: stop recording after `blocks` control blocks */
+void jackpifm_simdma_limit(uint64_t blocks);
+
+/* jackpifm_simdma_consumed: number of control blocks recorded so far */
+uint64_t jackpifm_simdma_consumed();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JACKPIFM_SIMDMA_H */
@@ -0,0 +1,85 @@
+/* stat.c - jackpifm-stat, prints the statistics published with --telemetry */
+
+#include "common.h"
+#include "telemetry.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+
+static void print_help(const char *basename) {
+  printf("Prints the live statistics of jackpifm instances started with --telemetry.\n"
+         "\n"
+         "Usage:\n"
+         "  %1$s [-i SECONDS] NAME...\n"
+         "  %1$s (-h | --help)\n"
+         "\n"
+         "Prints one line per instance, as space-separated key=value pairs. With -i,\n"
+         "keeps printing them every SECONDS seconds.\n",
+         basename);
+}
+
+static void print_stats(const char *name, const jackpifm_telemetry_t *t) {
+  jackpifm_telemetry_input_t in;
+  jackpifm_telemetry_output_t out;
+  jackpifm_telemetry_read(t, &in, &out);
+
+  bool alive = !kill(t->pid, 0) || errno == EPERM;
+  printf("%s pid=%u alive=%d rate=%u ringsize=%u delay=%u"
+         " jack_periods=%llu dropped=%llu limited=%llu reduction_db=%.2f reduction_max_db=%.2f process_ns=%llu process_max_ns=%llu"
+         " out_periods=%llu underruns=%llu ring_fill=%llu dma_queued=%llu coefficient=%.9f integral=%.3f"
+         " latency_us=%llu major_faults=%llu minor_faults=%llu\n",
+         name, t->pid, alive, t->rate, t->ringsize, t->delay,
+         (unsigned long long)in.periods, (unsigned long long)in.dropped, (unsigned long long)in.limited,
+         in.reduction_db, in.reduction_max_db,
+         (unsigned long long)in.process_ns, (unsigned long long)in.process_max_ns,
+         (unsigned long long)out.periods, (unsigned long long)out.underruns, (unsigned long long)out.ring_fill,
+         (unsigned long long)out.dma_queued, out.coefficient, out.integral, (unsigned long long)out.latency_ns / 1000,
+         (unsigned long long)out.major_faults, (unsigned long long)out.minor_faults);
+}
+
+int main(int argc, char **argv) {
+  double interval = 0;
+  int first = 1;
+
+  if (argc > 1 && (!strcmp(argv[1], "-h") || !strcmp(argv[1], "--help"))) {
+    print_help(argv[0]);
+    return 0;
+  }
+  if (argc > 2 && !strcmp(argv[1], "-i")) {
+    char *end;
+    interval = strtod(argv[2], &end);
+    if (*end || interval <= 0) {
+      fprintf(stderr, "Wrong interval value.\n");
+      return 1;
+    }
+    first = 3;
+  }
+  if (first >= argc) {
+    print_help(argv[0]);
+    return 1;
+  }
+
+  size_t count = argc - first;
+  const jackpifm_telemetry_t **segments = jackpifm_calloc(count, sizeof(*segments));
+  for (size_t i = 0; i < count; i++) {
+    segments[i] = jackpifm_telemetry_open(argv[first + i]);
+    if (!segments[i]) return 1;
+  }
+
+  struct timespec pause;
+  pause.tv_sec = (time_t)interval;
+  pause.tv_nsec = (long)((interval - pause.tv_sec) * 1e9);
+
+  do {
+    for (size_t i = 0; i < count; i++)
+      print_stats(argv[first + i], segments[i]);
+    fflush(stdout);
+  } while (interval > 0 && !nanosleep(&pause, NULL));
+
+  for (size_t i = 0; i < count; i++)
+    jackpifm_telemetry_close(segments[i], NULL);
+  free(segments);
+  return 0;
+}
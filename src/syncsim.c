@@ -0,0 +1,335 @@
+/* syncsim.c - simulates the ringbuffer / rate controller loop against modeled
+ * JACK and DMA clocks, run with `make syncsim` or `./jackpifm-syncsim --help`
+ *
+ * It replays the logic of process_callback() and output_thread() in main.c
+ * (with the real ringbuffer and controller), but time is simulated: JACK periods
+ * and output thread wakeups are events on a modeled timeline, and the DMA is a
+ * queue draining at the rate the outputter would set, off by the DMA clock error.
+ * With --sync 1 the DMA rate is fixed and the coefficient scales the resampler
+ * output instead, as with --sync=resamp.
+ * The results are deterministic for a given seed. */
+
+#include "common.h"
+
+#include <math.h>
+
+#include "controller.h"
+#include "outputter.h"
+#include "ring.h"
+
+#define PI 3.14159265358979323846
+
+// PARAMETERS
+// ----------
+
+typedef struct {
+  const char *name;
+  double *value;
+  const char *description;
+} param_t;
+
+static double duration = 3600;     // simulated seconds
+static double jrate = 48000;
+static double rate = 152000;
+static double jperiod = 256;
+static double operiod = 512;
+static double ringsize = 16384;
+static double dma_samples = JACKPIFM_BUFFERSAMPLES;
+static double jack_ppm = 40;       // JACK clock error
+static double dma_ppm = -60;       // DMA (PLLD) clock error
+static double wander = 0.5;        // random walk of both clocks, in ppm per sqrt(second)
+static double jack_jitter = 200e-6;   // JACK callback scheduling jitter, in seconds
+static double output_jitter = 500e-6; // output thread wakeup jitter, in seconds
+static double tolerance = 64;      // converged when the average fill stays this close to the target
+static double settle = 10;         // for at least this many seconds, up to the end
+static double seed = 1;
+static double sync_resamp = 0;    // 0: correct the DMA rate, 1: correct the resampling ratio
+
+static double ctl_smooth = 256;
+static double ctl_catch = 100000;
+static double ctl_catch2 = 10000;
+static double ctl_pclamp = 15;
+static double ctl_quant = 0;      // 0: 10000, or 1e7 with --sync 1 (as in jackpifm)
+static double ctl_max = 2;
+static double ctl_min = 0.5;
+
+static const param_t params[] = {
+  { "duration", &duration, "Simulated time, in seconds." },
+  { "jrate", &jrate, "JACK sample rate." },
+  { "rate", &rate, "Output sample rate." },
+  { "jperiod", &jperiod, "JACK period, in frames." },
+  { "period", &operiod, "Output period, in samples." },
+  { "ringsize", &ringsize, "Ringbuffer size (rounded up to a power of two)." },
+  { "dma-samples", &dma_samples, "DMA ring size, in samples." },
+  { "jack-ppm", &jack_ppm, "JACK clock error, in ppm." },
+  { "dma-ppm", &dma_ppm, "DMA clock error, in ppm." },
+  { "wander", &wander, "Random walk of each clock, in ppm per sqrt(second)." },
+  { "jack-jitter", &jack_jitter, "JACK callback jitter, in seconds." },
+  { "output-jitter", &output_jitter, "Output thread wakeup jitter, in seconds." },
+  { "tolerance", &tolerance, "Deviation of the per-second average fill considered converged, in samples." },
+  { "settle", &settle, "Seconds the average fill must stay within tolerance, up to the end, to be converged." },
+  { "seed", &seed, "Random seed." },
+  { "sync", &sync_resamp, "Absorb drift in the DMA rate (0) or the resampling ratio (1)." },
+  { "ctl-smooth", &ctl_smooth, "Controller smoothing window, in periods." },
+  { "ctl-catch", &ctl_catch, "Controller catch factor." },
+  { "ctl-catch2", &ctl_catch2, "Controller catch factor 2." },
+  { "ctl-pclamp", &ctl_pclamp, "Controller P clamp." },
+  { "ctl-quant", &ctl_quant, "Controller quantization (default 10000, or 1e7 with --sync 1)." },
+  { "ctl-max", &ctl_max, "Maximum rate coefficient." },
+  { "ctl-min", &ctl_min, "Minimum rate coefficient." },
+};
+
+#define PARAMS (sizeof(params) / sizeof(*params))
+
+static void print_help(const char *basename) {
+  printf("Simulates the ringbuffer and rate controller loop against drifting clocks.\n"
+         "\n"
+         "Usage: %s [--PARAM VALUE]...\n"
+         "\n"
+         "Parameters:\n", basename);
+  for (size_t i = 0; i < PARAMS; i++)
+    printf("  --%-15s %s [default: %g]\n", params[i].name, params[i].description, *params[i].value);
+}
+
+static int parse_params(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+      print_help(argv[0]);
+      exit(0);
+    }
+
+    size_t p;
+    for (p = 0; p < PARAMS; p++)
+      if (!strncmp(argv[i], "--", 2) && !strcmp(argv[i] + 2, params[p].name)) break;
+    if (p == PARAMS || i + 1 >= argc) {
+      fprintf(stderr, "Wrong option '%s' found.\n", argv[i]);
+      return 0;
+    }
+
+    char *end;
+    *params[p].value = strtod(argv[++i], &end);
+    if (*end) {
+      fprintf(stderr, "Wrong %s value.\n", params[p].name);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+
+// RANDOMNESS
+// ----------
+
+static uint64_t rng_state;
+
+static double random_uniform() {
+  // xorshift64*
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return ((rng_state * 2685821657736338717ull) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double random_normal() {
+  double u = random_uniform(), v = random_uniform();
+  return sqrt(-2 * log(u + 1e-300)) * cos(2*PI * v);
+}
+
+// Scheduling delays are never negative
+static double random_jitter(double scale) {
+  return fabs(random_normal()) * scale;
+}
+
+
+// CLOCKS
+// ------
+
+typedef struct {
+  double ppm;     // current error
+  double time;    // time of the last wander step
+} clock_model_t;
+
+// Advance the clock error random walk up to `time`
+static double clock_error(clock_model_t *clock, double time) {
+  if (time > clock->time) {
+    clock->ppm += wander * sqrt(time - clock->time) * random_normal();
+    clock->time = time;
+  }
+  return clock->ppm * 1e-6;
+}
+
+
+// SIMULATION
+// ----------
+
+typedef struct {
+  double sum, sum2, min, max;
+  size_t count;
+} stats_t;
+
+static void stats_add(stats_t *s, double x) {
+  if (!s->count || x < s->min) s->min = x;
+  if (!s->count || x > s->max) s->max = x;
+  s->sum += x;
+  s->sum2 += x * x;
+  s->count++;
+}
+
+static double stats_mean(const stats_t *s) {
+  return s->count ? s->sum / s->count : 0;
+}
+
+static double stats_stdev(const stats_t *s) {
+  if (!s->count) return 0;
+  double mean = stats_mean(s);
+  return sqrt(fmax(s->sum2 / s->count - mean * mean, 0));
+}
+
+int main(int argc, char **argv) {
+  if (!parse_params(argc, argv)) return 1;
+  rng_state = (uint64_t)seed * 0x9E3779B97F4A7C15ull + 1;
+
+  jackpifm_ring_t *ring = jackpifm_ring_new(ringsize);
+  size_t rsize = jackpifm_ring_size(ring);
+  size_t delay = rsize / 2;
+  size_t dma_size = dma_samples;
+  size_t op = operiod;
+  if (settle < 1) settle = 1;
+  if (!ctl_quant) ctl_quant = sync_resamp ? 1e7 : 10000;
+  if (op > dma_size || 2 * jperiod * rate / jrate > rsize) {
+    fprintf(stderr, "Ringbuffer (or DMA buffer) too small for the periods.\n");
+    return 1;
+  }
+
+  jackpifm_controller_t *controller = jackpifm_controller_new(1, delay, ctl_smooth, ctl_catch, ctl_catch2,
+                                                              ctl_pclamp, ctl_quant, ctl_max, ctl_min);
+  jackpifm_sample_t *buffer = jackpifm_calloc(rsize, sizeof(jackpifm_sample_t));
+
+  clock_model_t jack_clock = { jack_ppm, 0 }, dma_clock = { dma_ppm, 0 };
+
+  // JACK side
+  double jack_time = 0;        // ideal time of the next JACK period
+  double jack_event = random_jitter(jack_jitter);  // when it's actually run
+  double resamp_acc = 0;       // fractional output samples owed by the resampler
+  bool thread_started = false;
+  size_t drops = 0, jack_periods = 0;
+
+  // Output side
+  double output_time = INFINITY;  // next time the output thread runs
+  double dma_end = 0;             // time at which the DMA runs out of queued samples
+  double sample_time = 0;         // duration of the samples last queued
+  double coefficient = 1;
+  size_t underruns = 0, dma_underruns = 0, output_periods = 0;
+
+  // Measures
+  // (the fill saws by a whole period on each callback, so convergence is judged
+  // on its average over each second of output)
+  double start_time = 0, converged_time = 0, second_end = 0, last_time = 0;
+  stats_t fill_stats = {0}, latency_stats = {0}, coef_stats = {0}, second_stats = {0};
+
+  while (1) {
+    if (jack_event >= duration && output_time >= duration) break;
+
+    if (jack_event <= output_time) {
+      // process_callback(): resample a period, write it unless it would overwrite
+      resamp_acc += jperiod * rate / jrate * (sync_resamp ? coefficient : 1);
+      size_t iperiod = (size_t)resamp_acc;
+      resamp_acc -= iperiod;
+
+      if (jackpifm_ring_space(ring) >= iperiod)
+        jackpifm_ring_write(ring, buffer, iperiod);
+      else
+        drops++;
+      jack_periods++;
+
+      // Wake up the output thread once there's enough delay
+      if (!thread_started && jackpifm_ring_fill(ring) >= delay) {
+        thread_started = true;
+        output_time = jack_event + random_jitter(output_jitter);
+      }
+
+      jack_time += jperiod / (jrate * (1 + clock_error(&jack_clock, jack_time)));
+      jack_event = jack_time + random_jitter(jack_jitter);
+      continue;
+    }
+
+    // output_thread(): sync on the first run (the DMA buffer is full of silence)
+    double now = output_time;
+    if (!start_time) {
+      start_time = converged_time = now;
+      sample_time = 1 / (rate * (1 + clock_error(&dma_clock, now)));
+      dma_end = now + dma_size * sample_time;
+    }
+
+    size_t current_delay = jackpifm_ring_fill(ring);
+    if (!jackpifm_ring_read(ring, buffer, op))
+      underruns++;
+    coefficient = jackpifm_controller_process(controller, current_delay);
+    output_periods++;
+    last_time = now;
+
+    // Measures: the latency is the time a sample written now takes to be emitted
+    double dma_queued = fmax(dma_end - now, 0) / sample_time;
+    stats_add(&second_stats, current_delay - (double)delay);
+    stats_add(&fill_stats, current_delay - (double)delay);
+    stats_add(&latency_stats, (current_delay + dma_queued) / rate);
+    stats_add(&coef_stats, coefficient);
+    if (now >= second_end) {
+      if (fabs(stats_mean(&second_stats)) > tolerance) {
+        converged_time = now;
+        fill_stats = (stats_t){0};
+        latency_stats = (stats_t){0};
+        coef_stats = (stats_t){0};
+      }
+      second_stats = (stats_t){0};
+      second_end = now + 1;
+    }
+
+    // jackpifm_outputter_setup(rate / coefficient) + jackpifm_outputter_output():
+    // the samples are encoded for that rate, and emitted off by the DMA clock error.
+    // It returns once the last sample fits in the DMA buffer.
+    sample_time = (sync_resamp ? 1 : coefficient) / (rate * (1 + clock_error(&dma_clock, now)));
+    double done = fmax(now, dma_end - (dma_size - op) * sample_time);
+    if (dma_end < now) {
+      dma_underruns++;
+      dma_end = now;
+    }
+    dma_end += op * sample_time;
+    output_time = done + random_jitter(output_jitter);
+  }
+
+  // The loop is balanced when rate * (1 + jack error) = rate / coefficient * (1 + DMA error)
+  // (or rate * coefficient * (1 + jack error) = rate * (1 + DMA error), which is the same)
+  double expected = (1 + dma_clock.ppm * 1e-6) / (1 + jack_clock.ppm * 1e-6);
+  // Converged if the fill has been within tolerance for `settle` seconds up to the end,
+  // including the last, partial second
+  bool converged = start_time && last_time - converged_time >= settle &&
+                   (!second_stats.count || fabs(stats_mean(&second_stats)) <= tolerance);
+
+  printf("# simulated %.0fs (sync by %s): JACK %+.1f ppm, DMA %+.1f ppm (final), wander %.2f ppm/sqrt(s)\n",
+         duration, sync_resamp ? "resampling" : "DMA rate", jack_clock.ppm, dma_clock.ppm, wander);
+  printf("jack_periods %zu\n", jack_periods);
+  printf("output_periods %zu\n", output_periods);
+  printf("drops %zu\n", drops);
+  printf("underruns %zu\n", underruns);
+  printf("dma_underruns %zu\n", dma_underruns);
+  printf("converged %d\n", converged);
+  printf("convergence_s %.3f\n", converged ? converged_time - start_time : -1);
+  if (converged) {
+    printf("# after convergence:\n");
+    printf("fill_dev_mean %.2f\n", stats_mean(&fill_stats));
+    printf("fill_dev_stdev %.2f\n", stats_stdev(&fill_stats));
+    printf("fill_dev_max %.2f\n", fmax(fabs(fill_stats.min), fabs(fill_stats.max)));
+    printf("latency_mean_ms %.3f\n", stats_mean(&latency_stats) * 1e3);
+    printf("latency_stdev_ms %.3f\n", stats_stdev(&latency_stats) * 1e3);
+    printf("latency_range_ms %.3f\n", (latency_stats.max - latency_stats.min) * 1e3);
+    printf("coefficient_mean %.6f\n", stats_mean(&coef_stats));
+    printf("coefficient_stdev %.6f\n", stats_stdev(&coef_stats));
+  }
+  printf("coefficient_ideal %.6f\n", expected);
+
+  jackpifm_controller_free(controller);
+  jackpifm_ring_free(ring);
+  free(buffer);
+  return 0;
+}
@@ -0,0 +1,94 @@
+#include "telemetry.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+/* Seqlock writer: only one thread ever writes a given section, so a plain
+ * increment is enough; the fences order the data around the odd/even marks. */
+static void seq_write(uint32_t *seq, void *dest, const void *src, size_t size) {
+  uint32_t s = *seq;
+  __atomic_store_n(seq, s + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(dest, src, size);
+  __atomic_store_n(seq, s + 2, __ATOMIC_RELEASE);
+}
+
+/* Seqlock reader: retry until the section didn't change while copying */
+static void seq_read(const uint32_t *seq, void *dest, const void *src, size_t size) {
+  uint32_t before, after;
+  do {
+    while ((before = __atomic_load_n(seq, __ATOMIC_ACQUIRE)) & 1);
+    memcpy(dest, src, size);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    after = __atomic_load_n(seq, __ATOMIC_RELAXED);
+  } while (before != after);
+}
+
+jackpifm_telemetry_t *jackpifm_telemetry_create(const char *name) {
+  int fd = shm_open(name, O_RDWR|O_CREAT|O_TRUNC, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "Couldn't create shared memory '%s': %s\n", name, strerror(errno));
+    return NULL;
+  }
+  if (ftruncate(fd, sizeof(jackpifm_telemetry_t))) {
+    fprintf(stderr, "Couldn't resize shared memory '%s': %s\n", name, strerror(errno));
+    close(fd);
+    return NULL;
+  }
+
+  jackpifm_telemetry_t *t = mmap(NULL, sizeof(jackpifm_telemetry_t), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (t == MAP_FAILED) {
+    fprintf(stderr, "Couldn't map shared memory '%s': %s\n", name, strerror(errno));
+    return NULL;
+  }
+
+  memset(t, 0, sizeof(jackpifm_telemetry_t));
+  t->version = JACKPIFM_TELEMETRY_VERSION;
+  t->pid = getpid();
+  __atomic_store_n(&t->magic, JACKPIFM_TELEMETRY_MAGIC, __ATOMIC_RELEASE);
+  return t;
+}
+
+const jackpifm_telemetry_t *jackpifm_telemetry_open(const char *name) {
+  int fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0) {
+    fprintf(stderr, "Couldn't open shared memory '%s': %s\n", name, strerror(errno));
+    return NULL;
+  }
+
+  const jackpifm_telemetry_t *t = mmap(NULL, sizeof(jackpifm_telemetry_t), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (t == MAP_FAILED) {
+    fprintf(stderr, "Couldn't map shared memory '%s': %s\n", name, strerror(errno));
+    return NULL;
+  }
+
+  if (__atomic_load_n(&t->magic, __ATOMIC_ACQUIRE) != JACKPIFM_TELEMETRY_MAGIC || t->version != JACKPIFM_TELEMETRY_VERSION) {
+    fprintf(stderr, "'%s' isn't a jackpifm telemetry segment (or has another version).\n", name);
+    munmap((void *)t, sizeof(jackpifm_telemetry_t));
+    return NULL;
+  }
+  return t;
+}
+
+void jackpifm_telemetry_publish_input(jackpifm_telemetry_t *t, const jackpifm_telemetry_input_t *data) {
+  seq_write(&t->input.seq, &t->input.data, data, sizeof(*data));
+}
+
+void jackpifm_telemetry_publish_output(jackpifm_telemetry_t *t, const jackpifm_telemetry_output_t *data) {
+  seq_write(&t->output.seq, &t->output.data, data, sizeof(*data));
+}
+
+void jackpifm_telemetry_read(const jackpifm_telemetry_t *t, jackpifm_telemetry_input_t *input, jackpifm_telemetry_output_t *output) {
+  seq_read(&t->input.seq, input, &t->input.data, sizeof(*input));
+  seq_read(&t->output.seq, output, &t->output.data, sizeof(*output));
+}
+
+void jackpifm_telemetry_close(const jackpifm_telemetry_t *t, const char *name) {
+  if (!t) return;
+  munmap((void *)t, sizeof(jackpifm_telemetry_t));
+  if (name) shm_unlink(name);
+}
@@ -0,0 +1,90 @@
+/* telemetry.h - live statistics published in POSIX shared memory */
+
+#ifndef JACKPIFM_TELEMETRY_H
+#define JACKPIFM_TELEMETRY_H
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define JACKPIFM_TELEMETRY_MAGIC 0x4d46504a /* "JPFM" */
+#define JACKPIFM_TELEMETRY_VERSION 4
+
+/* Written by the JACK thread, once per period */
+typedef struct {
+  uint64_t periods;        // periods received from JACK
+  uint64_t dropped;        // periods dropped because the ringbuffer was full
+  uint64_t limited;        // frames in periods where the limiters reduced the gain
+  double reduction_db;     // deepest gain reduction in the last period, in dB
+  double reduction_max_db; // maximum of the above
+  uint64_t process_ns;     // time spent processing the last period
+  uint64_t process_max_ns; // maximum of the above
+} jackpifm_telemetry_input_t;
+
+/* Written by the output thread, once per period */
+typedef struct {
+  uint64_t periods;        // periods sent to the outputter
+  uint64_t underruns;      // periods the ringbuffer didn't have enough samples for
+  uint64_t ring_fill;      // ringbuffer fill (ipos - opos) before the last read
+  uint64_t dma_queued;     // samples queued in the DMA ring, not yet emitted
+  double coefficient;      // last rate coefficient given by the controller
+  double integral;         // integral term of the controller
+  uint64_t latency_ns;     // measured latency from JACK to the antenna (smoothed)
+  uint64_t major_faults;   // page faults (in the whole process) since activation that needed I/O,
+  uint64_t minor_faults;   // and that didn't; updated every few periods
+} jackpifm_telemetry_output_t;
+
+/* Each section has a single writer and is protected by a seqlock: the writer
+ * makes `seq` odd while it updates the data, and even again when done. */
+typedef struct {
+  uint32_t seq;
+  char pad[60];
+  jackpifm_telemetry_input_t data;
+} jackpifm_telemetry_input_section_t;
+
+typedef struct {
+  uint32_t seq;
+  char pad[60];
+  jackpifm_telemetry_output_t data;
+} jackpifm_telemetry_output_section_t;
+
+/* Layout of the shared memory segment */
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t pid;
+  uint32_t rate;           // target output rate
+  uint32_t ringsize;
+  uint32_t delay;          // target ringbuffer fill
+  char pad[40];
+
+  jackpifm_telemetry_input_section_t input __attribute__((aligned(64)));
+  jackpifm_telemetry_output_section_t output __attribute__((aligned(64)));
+} jackpifm_telemetry_t;
+
+/* jackpifm_telemetry_create: create (or replace) the segment `name` (such as "/jackpifm")
+ *                            and map it for writing. Returns NULL on error. */
+jackpifm_telemetry_t *jackpifm_telemetry_create(const char *name);
+
+/* jackpifm_telemetry_open: map an existing segment for reading. Returns NULL on error. */
+const jackpifm_telemetry_t *jackpifm_telemetry_open(const char *name);
+
+/* jackpifm_telemetry_publish_input: update the input section (JACK thread only) */
+void jackpifm_telemetry_publish_input(jackpifm_telemetry_t *t, const jackpifm_telemetry_input_t *data);
+
+/* jackpifm_telemetry_publish_output: update the output section (output thread only) */
+void jackpifm_telemetry_publish_output(jackpifm_telemetry_t *t, const jackpifm_telemetry_output_t *data);
+
+/* jackpifm_telemetry_read: take a consistent snapshot of both sections. Never blocks the writers. */
+void jackpifm_telemetry_read(const jackpifm_telemetry_t *t, jackpifm_telemetry_input_t *input, jackpifm_telemetry_output_t *output);
+
+/* jackpifm_telemetry_close: unmap the segment, and remove it if `name` isn't NULL */
+void jackpifm_telemetry_close(const jackpifm_telemetry_t *t, const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JACKPIFM_TELEMETRY_H */